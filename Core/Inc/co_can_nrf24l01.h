@@ -42,43 +42,613 @@ extern "C" {
 #endif
 
 #include "FreeRTOS.h"
-#include "queue.h"
+#include "task.h"
 
 #include "nrf24l01.h"
 #include "nrf24l01_hal_stm32l4xx.h"
 
 #include "co_if.h"
 
+#include "nrfcan_codec.h"
+#include "nrfcan_fec.h"
+#include "nrfcan_ring.h"
+
+/* Pack several queued CAN frames into a single radio payload */
+#ifndef NRFCAN_USE_AGGREGATION
+#define NRFCAN_USE_AGGREGATION      1
+#endif
+
+/* Newest frame format offered to peers during negotiation */
+#ifndef NRFCAN_CODEC_VERSION
+#define NRFCAN_CODEC_VERSION        NRFCAN_CODEC_V2
+#endif
+
+/* Announcement is repeated with outgoing traffic until some peer answers */
+#ifndef NRFCAN_HELLO_PERIOD
+#define NRFCAN_HELLO_PERIOD         (pdMS_TO_TICKS(1000))
+#endif
+
+/* Radio registers are compared with their shadow this often, radio which
+ * went through brown-out comes back powered down */
+#ifndef NRFCAN_HEALTH_PERIOD
+#define NRFCAN_HEALTH_PERIOD        (pdMS_TO_TICKS(500))
+#endif
+
+/* Send broadcast objects without requesting acknowledgment, requires
+ * nrf24l01_write_noack() (W_TX_PAYLOAD_NOACK) support in the radio driver */
+#ifndef NRFCAN_USE_NOACK
+#define NRFCAN_USE_NOACK            0
+#endif
+
+/* Traffic groups on separate addresses, so radio drops payloads of groups
+ * this node does not listen to before they cost any SPI transfer. Pipe 0
+ * follows destination for acknowledgments and is closed outside transmit
+ * windows unless destination is listened to anyway, pipe 1 takes broadcast
+ * objects, pipe 2 traffic directed to this node and the rest groups added
+ * by the application. Requires nrf24l01_pipe_open(), nrf24l01_pipe_close()
+ * and nrf24l01_tx_address() support in the radio driver */
+#ifndef NRFCAN_USE_PIPES
+#define NRFCAN_USE_PIPES            0
+#endif
+
+#define NRFCAN_PIPE_NUM             (6u)
+#define NRFCAN_PIPE_FIRST_GROUP     (3u)
+
+/* Low address byte of traffic groups, directed traffic uses node id */
+#define NRFCAN_GROUP_BROADCAST      (0x80u)
+#define NRFCAN_GROUP_SDO_CLIENT     (0x81u)
+/* Followed by one group per transmit PDO */
+#define NRFCAN_GROUP_PDO            (0x82u)
+
+/* Run radio transactions in a task woken by the interrupt instead of
+ * inside the interrupt itself */
+#ifndef NRFCAN_USE_SERVICE_TASK
+#define NRFCAN_USE_SERVICE_TASK     1
+#endif
+
+#ifndef NRFCAN_TASK_PRIO
+#define NRFCAN_TASK_PRIO            (configMAX_PRIORITIES - 2)
+#endif
+
+#ifndef NRFCAN_TASK_STACK_SIZE
+#define NRFCAN_TASK_STACK_SIZE      (configMINIMAL_STACK_SIZE << 1)
+#endif
+
+/* Size of transmit and receive rings in bytes, messages take only
+ * as much space as their payload needs */
+#ifndef NRFCAN_QUEUE_SIZE
+#define NRFCAN_QUEUE_SIZE           (512u)
+#endif
+
+/* Depth of radio transmit FIFO kept filled by the service */
+#ifndef NRFCAN_TX_FIFO_DEPTH
+#define NRFCAN_TX_FIFO_DEPTH        (3u)
+#endif
+
+typedef enum {
+    NRFCAN_CLASS_ACKED = 0,
+    NRFCAN_CLASS_BROADCAST,
+    NRFCAN_CLASS_NUM
+} nrfcan_class_t;
+
+/* Payloads written in one transmit window before receiver gets its turn */
+#ifndef NRFCAN_TX_WINDOW
+#define NRFCAN_TX_WINDOW            (8u)
+#endif
+
+/* Listen before talk backoff slot, contention window grows up to
+ * 2^NRFCAN_BACKOFF_MAX_EXP slots. Timed retries need the service task */
+#ifndef NRFCAN_BACKOFF_SLOT
+#define NRFCAN_BACKOFF_SLOT         (pdMS_TO_TICKS(1))
+#endif
+
+#ifndef NRFCAN_BACKOFF_MAX_EXP
+#define NRFCAN_BACKOFF_MAX_EXP      (5u)
+#endif
+
+/* Message is dropped when channel stays busy for longer than this since
+ * the message first contended for it */
+#ifndef NRFCAN_ACCESS_DEADLINE
+#define NRFCAN_ACCESS_DEADLINE      (pdMS_TO_TICKS(100))
+#endif
+
+/* Time division access, SYNC starts frame of NRFCAN_TDMA_SLOTS slots,
+ * slot 0 belongs to SYNC producer and the rest is shared by node ids.
+ * Slot timing needs the service task */
+#ifndef NRFCAN_USE_TDMA
+#define NRFCAN_USE_TDMA             0
+#endif
+
+#ifndef NRFCAN_TDMA_SYNC_ID
+#define NRFCAN_TDMA_SYNC_ID         (0x080u)
+#endif
+
+#ifndef NRFCAN_TDMA_SLOTS
+#define NRFCAN_TDMA_SLOTS           (8u)
+#endif
+
+#ifndef NRFCAN_TDMA_SLOT
+#define NRFCAN_TDMA_SLOT            (pdMS_TO_TICKS(2))
+#endif
+
+/* Node falls back to listen before talk when SYNC is missing for this long */
+#ifndef NRFCAN_TDMA_TIMEOUT
+#define NRFCAN_TDMA_TIMEOUT         (pdMS_TO_TICKS(1000))
+#endif
+
+/* Frequency hopping, every SYNC moves all nodes to the next channel of
+ * a permutation of NRFCAN_HOP_CHANNELS shared through NRFCAN_HOP_SEED.
+ * Needs the service task */
+#ifndef NRFCAN_USE_HOPPING
+#define NRFCAN_USE_HOPPING          0
+#endif
+
+/* Channels above 2473 MHz stay clear of Wi-Fi channels 1 to 11 */
+#ifndef NRFCAN_HOP_NUM
+#define NRFCAN_HOP_NUM              (8u)
+#define NRFCAN_HOP_CHANNELS         { 76, 81, 86, 91, 96, 101, 106, 111 }
+#endif
+
+#ifndef NRFCAN_HOP_SEED
+#define NRFCAN_HOP_SEED             (0x6e726663u)
+#endif
+
+/* Channel quality is an average of transmit outcomes scaled to 0..255,
+ * node does not transmit on channel which drops below the limit */
+#ifndef NRFCAN_HOP_BLACKLIST
+#define NRFCAN_HOP_BLACKLIST        (64u)
+#endif
+
+/* Quality regained by blacklisted channel on each visit, so it is tried again */
+#ifndef NRFCAN_HOP_RECOVER
+#define NRFCAN_HOP_RECOVER          (4u)
+#endif
+
+/* Backlog recheck period while sitting on blacklisted channel */
+#ifndef NRFCAN_HOP_HOLD
+#define NRFCAN_HOP_HOLD             (pdMS_TO_TICKS(10))
+#endif
+
+/* Count retransmissions of delivered payloads too, requires
+ * nrf24l01_observe_tx() (OBSERVE_TX) support in the radio driver */
+#ifndef NRFCAN_USE_OBSERVE
+#define NRFCAN_USE_OBSERVE          0
+#endif
+
+/* Tune auto retransmit count and delay to observed packet error rate.
+ * Without retransmission counts every delivered payload looks clean and
+ * the estimate only sees lost ones, so it follows OBSERVE by default */
+#ifndef NRFCAN_USE_ADAPTIVE_RETR
+#define NRFCAN_USE_ADAPTIVE_RETR    NRFCAN_USE_OBSERVE
+#endif
+
+#ifndef NRFCAN_RETR_COUNT_MIN
+#define NRFCAN_RETR_COUNT_MIN       (1u)
+#endif
+
+#ifndef NRFCAN_RETR_COUNT_MAX
+#define NRFCAN_RETR_COUNT_MAX       (15u)
+#endif
+
+/* Retransmit delay in microseconds, radio steps it by 250 us */
+#ifndef NRFCAN_RETR_DELAY_MIN
+#define NRFCAN_RETR_DELAY_MIN       (250u)
+#endif
+
+#ifndef NRFCAN_RETR_DELAY_MAX
+#define NRFCAN_RETR_DELAY_MAX       (1500u)
+#endif
+
+/* Residual loss after all retries the count is chosen for, 1/65535 units */
+#ifndef NRFCAN_RETR_TARGET
+#define NRFCAN_RETR_TARGET          (655u)
+#endif
+
+/* Transmit outcomes between two decisions */
+#ifndef NRFCAN_RETR_PERIOD
+#define NRFCAN_RETR_PERIOD          (16u)
+#endif
+
+/* Data rate adaptation, SYNC producer picks the rate from its packet error
+ * rate and announces the switch to peers. Requires nrf24l01_data_rate()
+ * support in the radio driver, adaptive retransmit and the service task */
+#ifndef NRFCAN_USE_RATE
+#define NRFCAN_USE_RATE             0
+#endif
+
+typedef enum {
+    NRFCAN_RATE_250K = 0,
+    NRFCAN_RATE_1M,
+    NRFCAN_RATE_2M,
+    NRFCAN_RATE_NUM
+} nrfcan_rate_t;
+
+/* Every node starts here */
+#ifndef NRFCAN_RATE_INITIAL
+#define NRFCAN_RATE_INITIAL         NRFCAN_RATE_1M
+#endif
+
+/* Packet error rate thresholds, 1/65535 units */
+#ifndef NRFCAN_RATE_UP
+#define NRFCAN_RATE_UP              (1311u)
+#endif
+
+#ifndef NRFCAN_RATE_DOWN
+#define NRFCAN_RATE_DOWN            (9830u)
+#endif
+
+/* Consecutive clean retransmit decisions before stepping up */
+#ifndef NRFCAN_RATE_UP_PERIODS
+#define NRFCAN_RATE_UP_PERIODS      (8u)
+#endif
+
+/* Announcement is repeated so that every peer catches it,
+ * all nodes switch this long after the first one */
+#ifndef NRFCAN_RATE_REPEAT
+#define NRFCAN_RATE_REPEAT          (3u)
+#endif
+
+#ifndef NRFCAN_RATE_SWITCH
+#define NRFCAN_RATE_SWITCH          (50u)
+#endif
+
+/* Node which hears nothing for this long tries the next rate */
+#ifndef NRFCAN_RATE_TIMEOUT
+#define NRFCAN_RATE_TIMEOUT         (pdMS_TO_TICKS(2000))
+#endif
+
+/* Reed-Solomon parity appended to every payload. Radio drops damaged
+ * payloads on its CRC before they could be corrected, so this only helps
+ * with CRC and auto acknowledgment disabled in the radio driver, parity
+ * then also takes over error detection */
+#ifndef NRFCAN_USE_FEC
+#define NRFCAN_USE_FEC              0
+#endif
+
+/* Two parity bytes correct one damaged byte */
+#ifndef NRFCAN_FEC_PARITY
+#define NRFCAN_FEC_PARITY           (4u)
+#endif
+
+/* Source node and sequence number in front of every V2 and control
+ * payload, receiver drops payloads it already accepted when their ACK got
+ * lost. V1 payloads go without it, so nodes which do not know the header
+ * still read them */
+#ifndef NRFCAN_USE_SEQUENCE
+#define NRFCAN_USE_SEQUENCE         1
+#endif
+
+/* Number of peers tracked at once, least recently added one is replaced */
+#ifndef NRFCAN_SEQ_SOURCES
+#define NRFCAN_SEQ_SOURCES          (8u)
+#endif
+
+/* Sequence numbers remembered per peer */
+#define NRFCAN_SEQ_WINDOW           (32u)
+
+/* Overwrite mailboxes for cyclic process data, reader always gets the
+ * newest value and other traffic keeps the receive ring to itself */
+#ifndef NRFCAN_USE_MAILBOX
+#define NRFCAN_USE_MAILBOX          1
+#endif
+
+#ifndef NRFCAN_MAILBOX_NUM
+#define NRFCAN_MAILBOX_NUM          (8u)
+#endif
+
+/* Drop received frames this node has no use for before they take receive
+ * ring space or wake the CAN task. Filter is inactive until the application
+ * adds the first identifier */
+#ifndef NRFCAN_USE_ACCEPT
+#define NRFCAN_USE_ACCEPT           1
+#endif
+
+/* Extended identifiers accepted, power of two, every extended frame is
+ * accepted once the table overflows */
+#ifndef NRFCAN_ACCEPT_EXT_NUM
+#define NRFCAN_ACCEPT_EXT_NUM       (16u)
+#endif
+
+#define NRFCAN_ACCEPT_STD_WORDS     (2048u / 32u)
+
+/* Replace queued frame with newer one of the same identifier instead of
+ * queueing both, applies to ranges listed in the driver */
+#ifndef NRFCAN_USE_COALESCE
+#define NRFCAN_USE_COALESCE         1
+#endif
+
+/* Queued frames carry deadline derived from their object, service sends
+ * earliest deadline first and drops frames which missed it. Deadlines
+ * are kept in 16 bits, so they must stay below 32768 ticks */
+#ifndef NRFCAN_USE_DEADLINE
+#define NRFCAN_USE_DEADLINE         1
+#endif
+
+/* Order in which queued frames are sent. Identifier order follows bus
+ * arbitration with deadline breaking ties, deadline order ignores identifier */
+#define NRFCAN_ORDER_IDENTIFIER     (0u)
+#define NRFCAN_ORDER_DEADLINE       (1u)
+
+#ifndef NRFCAN_TX_ORDER
+#define NRFCAN_TX_ORDER             NRFCAN_ORDER_IDENTIFIER
+#endif
+
+/* Typical SYNC period */
+#ifndef NRFCAN_DEADLINE_SYNC
+#define NRFCAN_DEADLINE_SYNC        (pdMS_TO_TICKS(20))
+#endif
+
+/* Typical PDO event timer */
+#ifndef NRFCAN_DEADLINE_PDO
+#define NRFCAN_DEADLINE_PDO         (pdMS_TO_TICKS(100))
+#endif
+
+/* Heartbeat producer time */
+#ifndef NRFCAN_DEADLINE_HEARTBEAT
+#define NRFCAN_DEADLINE_HEARTBEAT   (pdMS_TO_TICKS(500))
+#endif
+
+/* SDO timeout, also used for everything else */
+#ifndef NRFCAN_DEADLINE_SDO
+#define NRFCAN_DEADLINE_SDO         (pdMS_TO_TICKS(1000))
+#endif
+
+/* Identifier ranges with deadline taken from object dictionary, they take
+ * precedence over the typical values above */
+#ifndef NRFCAN_DEADLINE_NUM
+#define NRFCAN_DEADLINE_NUM         (8u)
+#endif
+
+/* Airtime budgets, bulk transfers are held to a share of airtime so they
+ * never crowd out process data, real-time traffic is not limited */
+#ifndef NRFCAN_USE_SHAPING
+#define NRFCAN_USE_SHAPING          1
+#endif
+
+/* Percentage of airtime bulk transfers may take on average */
+#ifndef NRFCAN_SHAPE_BULK_SHARE
+#define NRFCAN_SHAPE_BULK_SHARE     (50u)
+#endif
+
+/* Airtime in microseconds bulk transfers may use in one burst */
+#ifndef NRFCAN_SHAPE_BULK_BURST
+#define NRFCAN_SHAPE_BULK_BURST     (4000u)
+#endif
+
+/* Data rate airtime is estimated for when it is not adapted */
+#ifndef NRFCAN_SHAPE_KBPS
+#define NRFCAN_SHAPE_KBPS           (1000u)
+#endif
+
+/* Synthesizer settling time on every entry to receive or transmit mode */
+#define NRFCAN_SETTLE_US            (130u)
+
+typedef enum {
+    NRFCAN_SHAPE_REALTIME = 0,
+    NRFCAN_SHAPE_BULK,
+    NRFCAN_SHAPE_NUM
+} nrfcan_shape_t;
+
+typedef enum {
+    NRFCAN_MODE_UNKNOWN = 0,
+    NRFCAN_MODE_OFF,
+    NRFCAN_MODE_STANDBY,
+    NRFCAN_MODE_LISTEN,
+    NRFCAN_MODE_TRANSMIT
+} nrfcan_mode_t;
+
 typedef struct {
+    uint8_t             source;
+    uint8_t             valid;
+    uint8_t             last;
+    uint32_t            window;
+} nrfcan_source_t;
+
+typedef struct {
+    uint32_t            identifier;
+    volatile uint8_t    version;
+    volatile uint8_t    pending;
+    nrfcan_frame_t      frame;
+} nrfcan_mailbox_t;
+
+typedef struct {
+    uint16_t            first;
+    uint16_t            last;
+    TickType_t          lifetime;
+} nrfcan_deadline_range_t;
+
+typedef struct {
+    uint16_t            deadline;
+    uint16_t            access;
+    uint16_t            priority;
     uint8_t             size;
+    uint8_t             tclass;
+    uint8_t             shape;
+    uint8_t             group;
+    uint8_t             flags;
+    uint8_t             tag;
     uint8_t             data[NRF24L01_MAX_PAYLOAD_SIZE];
 }nrf24l01_message_t;
 
+/* Receive ring record, transmit scheduling fields are of no use there */
+typedef struct {
+    uint8_t             size;
+    uint8_t             source;
+    uint8_t             data[NRF24L01_MAX_PAYLOAD_SIZE];
+} nrf24l01_payload_t;
+
 typedef struct {
-    uint32_t            tx_complete;
-    uint32_t            tx_lost;
-    uint32_t            tx_postponed;
+    uint32_t            tx_complete[NRFCAN_CLASS_NUM];
+    uint32_t            tx_lost[NRFCAN_CLASS_NUM];
+    uint32_t            tx_postponed[NRFCAN_CLASS_NUM];
+    uint32_t            tx_aggregated[NRFCAN_CLASS_NUM];
+    uint32_t            tx_abandoned[NRFCAN_CLASS_NUM];
+    uint32_t            tx_coalesced[NRFCAN_CLASS_NUM];
+    uint32_t            tx_expired[NRFCAN_CLASS_NUM];
+    uint32_t            tx_slack_min;
+    uint32_t            tx_airtime_us[NRFCAN_SHAPE_NUM];
+    uint32_t            tx_shaped[NRFCAN_SHAPE_NUM];
+    uint32_t            tx_redirects;
+
+    uint32_t            access_count;
+    uint32_t            access_delay_total;
+    uint32_t            access_delay_max;
+
+    uint32_t            tdma_syncs;
+    uint32_t            tdma_deferred;
+
+    uint32_t            hops;
+    uint32_t            hop_deferred;
+    uint32_t            hop_complete[NRFCAN_HOP_NUM];
+    uint32_t            hop_lost[NRFCAN_HOP_NUM];
+    uint32_t            hop_postponed[NRFCAN_HOP_NUM];
+    uint8_t             hop_quality[NRFCAN_HOP_NUM];
+    uint32_t            hop_retries[NRFCAN_HOP_NUM];
+
+    uint32_t            tx_retries;
+    uint32_t            retr_per;
+    uint32_t            retr_count;
+    uint32_t            retr_delay;
+    uint32_t            retr_decisions;
+    uint32_t            retr_changes;
+
+    uint32_t            rate_kbps;
+    uint32_t            rate_ups;
+    uint32_t            rate_downs;
+    uint32_t            rate_scans;
 
     uint32_t            rx_complete;
     uint32_t            rx_lost;
+    uint32_t            rx_duplicates;
+    uint32_t            rx_mailbox;
+    uint32_t            rx_overwritten;
+    uint32_t            rx_filtered;
+
+    uint32_t            fec_corrected;
+    uint32_t            fec_repaired;
+    uint32_t            fec_failed;
+
+    uint32_t            resyncs;
+    uint32_t            resync_failed;
+    uint32_t            health_no_answer;
+    uint32_t            mode_switches;
+    uint32_t            settle_us;
+    uint32_t            settle_us_per_s;
+
+    uint32_t            events;
+    uint32_t            commands;
+    uint32_t            commands_max;
+
+    uint32_t            irq_cycles_max;
+    uint32_t            wake_cycles_max;
+    uint32_t            event_cycles_max;
 } nrf24l01_stats_t;
 
 typedef struct nrf24l01_service {
     nrf24l01_t          device;
+    nrf24l01_config_t   config;
+    nrfcan_mode_t       mode;
+    volatile uint8_t    mode_request;
     nrf24l01_stats_t    stats;
+    nrfcan_codec_t      codec;
+    nrfcan_fec_t        fec;
 
-    nrf24l01_message_t  txbuff[16];
-    QueueHandle_t       txq;
-    StaticQueue_t       txc;
+    uint8_t             node_id;
+    TickType_t          hello_at;
+    uint8_t             txseq;
+    uint8_t             source_next;
+    nrfcan_source_t     sources[NRFCAN_SEQ_SOURCES];
 
-    nrf24l01_message_t  rxbuff[16];
-    QueueHandle_t       rxq;
-    StaticQueue_t       rxc;
+    uint8_t             pipe_groups[NRFCAN_PIPE_NUM - NRFCAN_PIPE_FIRST_GROUP];
+    uint8_t             pipe_count;
+    uint8_t             pipe_tx;
+    uint8_t             pipe0_open;
+
+    uint8_t             commands;
+    uint8_t             txwindow;
+    uint32_t            settle_us;
+    TickType_t          settle_start;
+    TickType_t          health_at;
+
+    uint8_t             backoff;
+    uint8_t             retry;
+    TickType_t          retry_at;
+    uint32_t            seed;
+
+    uint8_t             tdma_slot;
+    uint8_t             tdma_synced;
+    TickType_t          tdma_sync;
+
+    uint8_t             hop_seq[NRFCAN_HOP_NUM];
+    uint8_t             hop_pos;
+    uint8_t             hop_pending;
+
+    uint32_t            per;
+    uint8_t             outcomes;
+    uint8_t             retr_pending;
+
+    uint8_t             rate;
+    uint8_t             rate_next;
+    uint8_t             rate_seq;
+    uint8_t             rate_clean;
+    uint8_t             rate_master;
+    uint8_t             rate_switch;
+    TickType_t          rate_at;
+    TickType_t          rate_heard;
+
+    int32_t             shape_tokens[NRFCAN_SHAPE_NUM];
+    TickType_t          shape_refill;
+
+    uint8_t             txslot[NRFCAN_TX_FIFO_DEPTH];
+    uint8_t             txhead;
+    uint8_t             txcount;
+    uint8_t             txtag;
+
+    uint16_t            txbuff[NRFCAN_QUEUE_SIZE / sizeof(uint16_t)];
+    nrfcan_ring_t       txq;
+
+    uint16_t            rxbuff[NRFCAN_QUEUE_SIZE / sizeof(uint16_t)];
+    nrfcan_ring_t       rxq;
+
+    nrfcan_deadline_range_t deadline_ranges[NRFCAN_DEADLINE_NUM];
+    uint8_t             deadline_count;
+
+    nrfcan_mailbox_t    mailboxes[NRFCAN_MAILBOX_NUM];
+    uint8_t             mailbox_count;
+    uint8_t             mailbox_fresh;
+
+    uint32_t            accept_std[NRFCAN_ACCEPT_STD_WORDS];
+    uint32_t            accept_ext[NRFCAN_ACCEPT_EXT_NUM];
+    uint8_t             accept_active;
+    uint8_t             accept_ext_all;
+
+    nrf24l01_payload_t *rxmsg;
+    uint8_t             rxpos;
+    uint16_t            rxnext;
+    TaskHandle_t        rxtask;
+
+    TaskHandle_t        task;
+    volatile uint32_t   irqstamp;
+    volatile uint8_t    irqpending;
 } nrf24l01_service_t;
 
 
 extern const CO_IF_CAN_DRV co_can_nrf24l01;
 
+extern int co_can_nrf24l01_dict_add(uint32_t identifier);
+
+extern void co_can_nrf24l01_tdma_slot(uint8_t node_id);
+
+extern void co_can_nrf24l01_node_id(uint8_t node_id);
+
+extern int co_can_nrf24l01_mailbox_add(uint32_t identifier);
+
+extern int co_can_nrf24l01_pipe_add(uint32_t identifier);
+
+extern int co_can_nrf24l01_accept_add(uint32_t identifier);
+
+extern int co_can_nrf24l01_deadline_add(uint32_t first, uint32_t last, uint32_t lifetime_ms);
+
 #ifdef __cpluplus 
 }
 #endif
@@ -0,0 +1,121 @@
+/**
+ ******************************************************************************
+ * @file        nrfcan_codec.h
+ * @author      Zoltan Dolensky
+ * @brief       
+ *
+ ******************************************************************************
+ * @attention
+ *
+ * MIT License
+ * -----------
+ * Copyright (c) 2022 Technical university of Liberec (https://tul.cz)
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ ******************************************************************************
+ */
+
+#ifndef INC_NRFCAN_CODEC_H_
+#define INC_NRFCAN_CODEC_H_
+
+#ifdef __cpluplus 
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+/* Frame header formats */
+#define NRFCAN_CODEC_V1             (1u)
+#define NRFCAN_CODEC_V2             (2u)
+
+/* Number of identifiers which can be encoded as dictionary index */
+#define NRFCAN_CODEC_DICT_SIZE      (6u)
+
+/* Dictionary entry is a function code, sender adds its node id to it */
+#define NRFCAN_CODEC_DICT_NODE      (0x8000u)
+
+/* Largest encoded frame */
+#define NRFCAN_CODEC_FRAME_MAX      (5u + 8u)
+
+/* Link header in front of V2 and control payloads, sequence number wraps
+ * after NRFCAN_CODEC_SEQ_NUM payloads */
+#define NRFCAN_CODEC_LINK_SIZE      (2u)
+#define NRFCAN_CODEC_SEQ_NUM        (64u)
+
+/* Control payload types */
+#define NRFCAN_CODEC_HELLO          (0x01)
+#define NRFCAN_CODEC_HELLO_REPLY    (0x02)
+#define NRFCAN_CODEC_HELLO_SIZE     (4u + (2u * NRFCAN_CODEC_DICT_SIZE))
+#define NRFCAN_CODEC_RATE           (0x03)
+#define NRFCAN_CODEC_RATE_SIZE      (6u)
+
+typedef struct {
+    uint32_t            identifier;
+    uint8_t             dlc;
+    uint8_t             data[8];
+} nrfcan_frame_t;
+
+typedef struct nrfcan_codec {
+    uint8_t             version;
+    uint8_t             version_max;
+    uint8_t             version_heard;
+    uint8_t             node;
+    uint8_t             dict_mask;
+    uint8_t             dict_size;
+    uint16_t            dict[NRFCAN_CODEC_DICT_SIZE];
+} nrfcan_codec_t;
+
+extern void     nrfcan_codec_init(nrfcan_codec_t *codec, uint8_t version_max);
+
+extern int      nrfcan_codec_dict_add(nrfcan_codec_t *codec, uint32_t identifier);
+
+extern void     nrfcan_codec_node(nrfcan_codec_t *codec, uint8_t node);
+
+extern int      nrfcan_codec_encode(const nrfcan_codec_t *codec, const nrfcan_frame_t *frame, uint8_t *buf, uint8_t size);
+
+extern int      nrfcan_codec_append(uint8_t *payload, uint8_t *size, uint8_t max, const uint8_t *buf, uint8_t length);
+
+extern int      nrfcan_codec_decode(const nrfcan_codec_t *codec, const uint8_t *payload, uint8_t size, uint8_t *pos, uint8_t source, nrfcan_frame_t *frame);
+
+extern int      nrfcan_codec_remove(uint8_t *payload, uint8_t *size, uint8_t from, uint8_t to);
+
+extern int      nrfcan_codec_is_control(const uint8_t *payload, uint8_t size);
+
+extern int      nrfcan_codec_is_v2(const uint8_t *payload, uint8_t size);
+
+extern int      nrfcan_codec_link(uint8_t source, uint8_t seq, uint8_t *buf, uint8_t size);
+
+extern int      nrfcan_codec_on_link(uint8_t *payload, uint8_t *size, uint8_t *source, uint8_t *seq);
+
+extern int      nrfcan_codec_hello(const nrfcan_codec_t *codec, uint8_t type, uint8_t *buf, uint8_t size);
+
+extern int      nrfcan_codec_on_control(nrfcan_codec_t *codec, const uint8_t *payload, uint8_t size);
+
+extern int      nrfcan_codec_rate(uint8_t seq, uint8_t rate, uint16_t delay, uint8_t *buf, uint8_t size);
+
+extern int      nrfcan_codec_on_rate(const uint8_t *payload, uint8_t size, uint8_t *seq, uint8_t *rate, uint16_t *delay);
+
+#ifdef __cpluplus 
+}
+#endif
+
+#endif /* INC_NRFCAN_CODEC_H_ */
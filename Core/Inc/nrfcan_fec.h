@@ -0,0 +1,64 @@
+/**
+ ******************************************************************************
+ * @file        nrfcan_fec.h
+ * @author      Zoltan Dolensky
+ * @brief       
+ *
+ ******************************************************************************
+ * @attention
+ *
+ * MIT License
+ * -----------
+ * Copyright (c) 2022 Technical university of Liberec (https://tul.cz)
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ ******************************************************************************
+ */
+
+#ifndef INC_NRFCAN_FEC_H_
+#define INC_NRFCAN_FEC_H_
+
+#ifdef __cpluplus 
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+/* Largest number of parity bytes, corrects half as many byte errors */
+#define NRFCAN_FEC_PARITY_MAX       (16u)
+
+typedef struct nrfcan_fec {
+    uint8_t             parity;
+    uint8_t             generator[NRFCAN_FEC_PARITY_MAX + 1];
+} nrfcan_fec_t;
+
+extern int      nrfcan_fec_init(nrfcan_fec_t *fec, uint8_t parity);
+
+extern int      nrfcan_fec_encode(const nrfcan_fec_t *fec, uint8_t *buf, uint8_t length, uint8_t size);
+
+extern int      nrfcan_fec_decode(const nrfcan_fec_t *fec, uint8_t *buf, uint8_t size);
+
+#ifdef __cpluplus 
+}
+#endif
+
+#endif /* INC_NRFCAN_FEC_H_ */
@@ -0,0 +1,83 @@
+/**
+ ******************************************************************************
+ * @file        nrfcan_ring.h
+ * @author      Zoltan Dolensky
+ * @brief       
+ *
+ ******************************************************************************
+ * @attention
+ *
+ * MIT License
+ * -----------
+ * Copyright (c) 2022 Technical university of Liberec (https://tul.cz)
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ ******************************************************************************
+ */
+
+#ifndef INC_NRFCAN_RING_H_
+#define INC_NRFCAN_RING_H_
+
+#ifdef __cpluplus 
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+/* Records start at multiples of this, strictest member of any record is
+ * uint16_t. Buffer must be aligned to it and its size must be a multiple */
+#define NRFCAN_RING_ALIGN           (2u)
+
+typedef struct nrfcan_ring {
+    uint8_t            *buff;
+    uint16_t            size;
+    volatile uint16_t   head;
+    volatile uint16_t   tail;
+    uint16_t            next;
+
+    volatile uint32_t   produced;
+    volatile uint32_t   consumed;
+    uint16_t            hwm_bytes;
+    uint16_t            hwm_frames;
+} nrfcan_ring_t;
+
+extern void     nrfcan_ring_init(nrfcan_ring_t *ring, void *buff, uint16_t size);
+
+extern void*    nrfcan_ring_reserve(nrfcan_ring_t *ring, uint8_t length);
+
+extern void     nrfcan_ring_commit(nrfcan_ring_t *ring, uint8_t length);
+
+extern uint16_t nrfcan_ring_cursor(nrfcan_ring_t *ring);
+
+extern void*    nrfcan_ring_peek(nrfcan_ring_t *ring, uint16_t *cursor, uint8_t *length);
+
+extern void     nrfcan_ring_release(nrfcan_ring_t *ring, uint16_t cursor, uint16_t count);
+
+extern uint16_t nrfcan_ring_bytes(nrfcan_ring_t *ring);
+
+extern uint16_t nrfcan_ring_frames(nrfcan_ring_t *ring);
+
+#ifdef __cpluplus 
+}
+#endif
+
+#endif /* INC_NRFCAN_RING_H_ */
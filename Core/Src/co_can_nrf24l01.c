@@ -34,9 +34,114 @@
  ******************************************************************************
  */
 
+#include <stddef.h>
+#include <string.h>
+
+#include "stm32l4xx.h"
+
 #include "co_can_nrf24l01.h"
 
-#define NRFCAN_DLC_EXT_ID           (1 << 7)
+/* Ring record length, only used part of payload is stored */
+#define NRFCAN_MESSAGE_LENGTH(m)    (offsetof(nrf24l01_message_t, data) + (m)->size)
+#define NRFCAN_PAYLOAD_LENGTH(p)    (offsetof(nrf24l01_payload_t, data) + (p)->size)
+
+/* STATUS register, transmit FIFO full flag */
+#define NRFCAN_STATUS_TX_FULL       (1 << 0)
+/* STATUS register, pipe of payload at head of receive FIFO, all ones when empty */
+#define NRFCAN_STATUS_RX_P_NO       (0x07 << 1)
+
+/* CONFIG register, read through nrf24l01_read_register() */
+#define NRFCAN_REG_CONFIG           (0x00)
+#define NRFCAN_CONFIG_PRIM_RX       (1 << 0)
+#define NRFCAN_CONFIG_PWR_UP        (1 << 1)
+
+/* FIFO_STATUS register, read through nrf24l01_read_register() */
+#define NRFCAN_REG_FIFO_STATUS      (0x17)
+#define NRFCAN_FIFO_RX_EMPTY        (1 << 0)
+#define NRFCAN_FIFO_TX_EMPTY        (1 << 4)
+
+/* SYNC drives time division frames and channel hops */
+#define NRFCAN_USE_SYNC             ((NRFCAN_USE_TDMA == 1) || (NRFCAN_USE_HOPPING == 1))
+
+#if (NRFCAN_USE_SYNC == 1) && (NRFCAN_USE_SERVICE_TASK != 1)
+#error "Time division and channel hopping need the service task"
+#endif
+
+#if ((NRFCAN_QUEUE_SIZE % NRFCAN_RING_ALIGN) != 0)
+#error "Queue size must be a multiple of ring record alignment"
+#endif
+
+#if (NRFCAN_USE_RATE == 1) && ((NRFCAN_USE_ADAPTIVE_RETR != 1) || (NRFCAN_USE_SERVICE_TASK != 1))
+#error "Data rate adaptation needs adaptive retransmit and the service task"
+#endif
+
+/* Received payloads are split into mailboxes, filtered out frames and the rest */
+#define NRFCAN_USE_SORT             ((NRFCAN_USE_MAILBOX == 1) || (NRFCAN_USE_ACCEPT == 1))
+
+/* Link header, source node and sequence number */
+#if (NRFCAN_USE_SEQUENCE == 1)
+#define NRFCAN_LINK_HEADER          (NRFCAN_CODEC_LINK_SIZE)
+#if ((NRFCAN_SEQ_WINDOW * 2) > NRFCAN_CODEC_SEQ_NUM)
+#error "Sequence window must not cover more than half of sequence numbers"
+#endif
+#else
+#define NRFCAN_LINK_HEADER          (0u)
+#endif
+
+#if (NRFCAN_USE_FEC == 1)
+#define NRFCAN_LINK_PARITY          (NRFCAN_FEC_PARITY)
+#else
+#define NRFCAN_LINK_PARITY          (0u)
+#endif
+
+/* Room left for frames once link header and error correction took their share */
+#define NRFCAN_PAYLOAD_LIMIT        (NRF24L01_MAX_PAYLOAD_SIZE - NRFCAN_LINK_HEADER - NRFCAN_LINK_PARITY)
+
+/* Order shared data accesses against the flag publishing them */
+#define NRFCAN_BARRIER()            __sync_synchronize()
+
+/* Transmit message flags */
+#define NRFCAN_MESSAGE_SYNC         (1u << 0)
+#define NRFCAN_MESSAGE_RATE         (1u << 1)
+/* Record was sent or dropped, it is released once all records before it are */
+#define NRFCAN_MESSAGE_DONE         (1u << 2)
+/* Record was held back by airtime budget at least once */
+#define NRFCAN_MESSAGE_SHAPED       (1u << 3)
+/* Record sits in radio fifo, tag tells which of its payloads */
+#define NRFCAN_MESSAGE_INFLIGHT     (1u << 4)
+/* Record is not part of the backlog */
+#define NRFCAN_MESSAGE_TAKEN        (NRFCAN_MESSAGE_DONE | NRFCAN_MESSAGE_INFLIGHT)
+/* Record was in the backlog when channel was sampled, access holds when */
+#define NRFCAN_MESSAGE_CONTENDED    (1u << 5)
+
+/* Mode requests posted to the service, close is applied before open */
+#define NRFCAN_REQUEST_CLOSE        (1u << 0)
+#define NRFCAN_REQUEST_OPEN         (1u << 1)
+
+/* Preamble, address, packet control field and CRC around every payload */
+#define NRFCAN_AIR_OVERHEAD         (1u + 5u + 2u + 2u)
+
+typedef struct {
+    uint16_t            first;
+    uint16_t            last;
+    nrfcan_class_t      tclass;
+} nrfcan_class_range_t;
+
+typedef struct {
+    uint16_t            first;
+    uint16_t            last;
+} nrfcan_range_t;
+
+typedef struct {
+    uint8_t             share;
+    uint32_t            burst;
+} nrfcan_budget_t;
+
+typedef struct {
+    uint16_t            first;
+    uint16_t            last;
+    uint8_t             group;
+} nrfcan_group_range_t;
 
 static void     DrvCanInit(void);
 static void     DrvCanEnable(uint32_t baudrate);
@@ -45,12 +150,172 @@ static int16_t  DrvCanRead(CO_IF_FRM *frm);
 static void     DrvCanReset(void);
 static void     DrvCanClose(void);
 
+static TickType_t nrf24l01_service_ticks(void);
+static void     nrf24l01_service_switched(nrf24l01_service_t *svc, nrfcan_mode_t mode);
+static void     nrf24l01_service_mode(nrf24l01_service_t *svc, nrfcan_mode_t mode);
+static void     nrf24l01_service_configure(nrf24l01_service_t *svc, const nrf24l01_config_t *config);
+static void     nrf24l01_service_resync(nrf24l01_service_t *svc);
+static void     nrf24l01_service_health(nrf24l01_service_t *svc);
+static void     nrf24l01_service_request(nrf24l01_service_t *svc, uint8_t request);
+static void     nrf24l01_service_on_request(nrf24l01_service_t *svc);
+static nrf24l01_message_t* nrf24l01_service_alloc(nrf24l01_service_t *svc);
 static int      nrf24l01_service_send(nrf24l01_service_t *svc, nrf24l01_message_t *message);
-static int      nrf24l01_service_recv(nrf24l01_service_t *svc, nrf24l01_message_t *message);
-static void     nrf24l01_service_on_event(void *context);
+static void     nrf24l01_service_hello(nrf24l01_service_t *svc);
+static nrf24l01_payload_t* nrf24l01_service_recv(nrf24l01_service_t *svc);
+static uint8_t  nrf24l01_service_classify(uint32_t identifier);
+static uint16_t nrf24l01_service_deadline(nrf24l01_service_t *svc, uint32_t identifier);
+static uint16_t nrf24l01_service_priority(uint32_t identifier);
+static int      nrf24l01_service_before(const nrf24l01_message_t *message, const nrf24l01_message_t *other);
+static void     nrf24l01_service_reclaim(nrf24l01_service_t *svc);
+static nrf24l01_message_t* nrf24l01_service_pick(nrf24l01_service_t *svc, TickType_t now, uint16_t *after);
+#if (NRFCAN_USE_COALESCE == 1)
+static int      nrf24l01_service_coalescable(uint32_t identifier);
+static int      nrf24l01_service_coalesce(nrf24l01_service_t *svc, const uint8_t *buf, uint8_t size, uint8_t dlc, uint16_t deadline);
+#endif
+#if (NRFCAN_USE_SHAPING == 1)
+static uint8_t  nrf24l01_service_shape(uint32_t identifier);
+static void     nrf24l01_service_refill(nrf24l01_service_t *svc, TickType_t now);
+static int      nrf24l01_service_budget(nrf24l01_service_t *svc, nrf24l01_message_t *message);
+static void     nrf24l01_service_charge(nrf24l01_service_t *svc, uint8_t shape, uint8_t bytes);
+#endif
+#if (NRFCAN_USE_PIPES == 1)
+static uint8_t  nrf24l01_service_group(uint32_t identifier);
+static void     nrf24l01_service_pipes(nrf24l01_service_t *svc);
+static uint8_t  nrf24l01_service_listened(nrf24l01_service_t *svc, uint8_t group);
+static void     nrf24l01_service_pipe0(nrf24l01_service_t *svc, nrfcan_mode_t mode);
+static int      nrf24l01_service_redirect(nrf24l01_service_t *svc, const nrf24l01_message_t *message);
+#endif
+static void     nrf24l01_service_write(nrf24l01_service_t *svc, nrf24l01_message_t *message);
+static void     nrf24l01_service_settle(nrf24l01_service_t *svc, uint8_t done);
+static void     nrf24l01_service_complete(nrf24l01_service_t *svc);
+static void     nrf24l01_service_drained(nrf24l01_service_t *svc, uint8_t fifo);
+static uint32_t nrf24l01_service_random(nrf24l01_service_t *svc);
+static uint8_t  nrf24l01_service_contend(nrf24l01_service_t *svc, TickType_t now, uint8_t busy);
+static void     nrf24l01_service_accessed(nrf24l01_service_t *svc, const nrf24l01_message_t *message, TickType_t now);
+static void     nrf24l01_service_backoff(nrf24l01_service_t *svc, TickType_t now);
+#if (NRFCAN_USE_TDMA == 1)
+static int      nrf24l01_service_slot(nrf24l01_service_t *svc, TickType_t now, TickType_t *next);
+#endif
+#if (NRFCAN_USE_HOPPING == 1)
+static uint8_t  nrf24l01_service_hop_init(nrf24l01_service_t *svc);
+static void     nrf24l01_service_hop(nrf24l01_service_t *svc);
+static void     nrf24l01_service_quality(nrf24l01_service_t *svc, uint8_t good);
+#endif
+#if (NRFCAN_USE_ADAPTIVE_RETR == 1)
+static void     nrf24l01_service_observe(nrf24l01_service_t *svc, uint8_t retries, uint8_t lost);
+static void     nrf24l01_service_retr(nrf24l01_service_t *svc);
+#endif
+#if (NRFCAN_USE_RATE == 1)
+static void     nrf24l01_service_rate(nrf24l01_service_t *svc);
+static void     nrf24l01_service_rate_propose(nrf24l01_service_t *svc, uint8_t rate);
+static void     nrf24l01_service_rate_switch(nrf24l01_service_t *svc, TickType_t now);
+static void     nrf24l01_service_on_rate(nrf24l01_service_t *svc, const nrf24l01_payload_t *message);
+#endif
+static int      nrf24l01_service_accept(nrf24l01_service_t *svc, nrf24l01_payload_t *message);
+#if (NRFCAN_USE_SORT == 1)
+static uint8_t  nrf24l01_service_sort(nrf24l01_service_t *svc, nrf24l01_payload_t *message);
+#endif
+#if (NRFCAN_USE_ACCEPT == 1)
+static uint8_t  nrf24l01_service_ext_slot(uint32_t identifier);
+static int      nrf24l01_service_wanted(nrf24l01_service_t *svc, uint32_t identifier);
+#endif
+#if (NRFCAN_USE_MAILBOX == 1)
+static int      nrf24l01_service_mailbox_find(nrf24l01_service_t *svc, uint32_t identifier);
+static void     nrf24l01_service_mailbox_put(nrf24l01_service_t *svc, int index, const nrfcan_frame_t *frame);
+static int      nrf24l01_service_mailbox_take(nrf24l01_service_t *svc, nrfcan_frame_t *frame);
+#endif
+#if (NRFCAN_USE_FEC == 1)
+static int      nrf24l01_service_repair(nrf24l01_service_t *svc, nrf24l01_payload_t *message);
+#endif
+#if (NRFCAN_USE_SEQUENCE == 1)
+static int      nrf24l01_service_duplicate(nrf24l01_service_t *svc, uint8_t source, uint8_t seq, const nrf24l01_payload_t *message);
+#endif
+#if (NRFCAN_USE_SYNC == 1)
+static int      nrf24l01_service_held(nrf24l01_service_t *svc, const nrf24l01_message_t *message, TickType_t now);
+static void     nrf24l01_service_synced(nrf24l01_service_t *svc, TickType_t now);
+static void     nrf24l01_service_on_sync(nrf24l01_service_t *svc, const nrf24l01_payload_t *message);
+#endif
+static void     nrf24l01_service_transmit(nrf24l01_service_t *svc);
+static void     nrf24l01_service_on_control(nrf24l01_service_t *svc, nrf24l01_payload_t *message);
+static void     nrf24l01_service_kick(nrf24l01_service_t *svc);
+static void     nrf24l01_service_on_irq(void *context);
+#if (NRFCAN_USE_SERVICE_TASK == 1)
+static TickType_t nrf24l01_service_timeout(nrf24l01_service_t *svc);
+static void     nrf24l01_service_task(void *context);
+#endif
+static void     nrf24l01_service_on_event(nrf24l01_service_t *svc, BaseType_t *woken);
 
 static nrf24l01_service_t service;
 
+#if (NRFCAN_USE_SERVICE_TASK == 1)
+static StackType_t  service_stack[NRFCAN_TASK_STACK_SIZE];
+static StaticTask_t service_cntrl;
+#endif
+
+/* Objects consumed by any number of nodes gain nothing from a single ACK */
+static const nrfcan_class_range_t classes[] = {
+    { 0x080, 0x080, NRFCAN_CLASS_BROADCAST },   /* SYNC      */
+    { 0x100, 0x100, NRFCAN_CLASS_BROADCAST },   /* TIME      */
+    { 0x180, 0x57f, NRFCAN_CLASS_BROADCAST },   /* PDO       */
+    { 0x701, 0x77f, NRFCAN_CLASS_BROADCAST },   /* Heartbeat */
+};
+
+/* How long a queued frame stays useful, follows refresh period of its object,
+ * used unless the application gave the period from its object dictionary */
+static const nrfcan_deadline_range_t deadlines[] = {
+    { 0x080, 0x080, NRFCAN_DEADLINE_SYNC      },    /* SYNC      */
+    { 0x180, 0x57f, NRFCAN_DEADLINE_PDO       },    /* PDO       */
+    { 0x701, 0x77f, NRFCAN_DEADLINE_HEARTBEAT },    /* Heartbeat */
+};
+
+#if (NRFCAN_USE_COALESCE == 1)
+/* Cyclic objects where only the newest value is worth sending */
+static const nrfcan_range_t coalesced[] = {
+    { 0x180, 0x57f },                           /* PDO       */
+    { 0x701, 0x77f },                           /* Heartbeat */
+};
+#endif
+
+#if (NRFCAN_USE_SHAPING == 1)
+/* Bulk transfers, everything else is real-time */
+static const nrfcan_range_t bulk[] = {
+    { 0x580, 0x67f },                           /* SDO       */
+};
+
+/* Full share leaves the class unlimited */
+static const nrfcan_budget_t budgets[NRFCAN_SHAPE_NUM] = {
+    { 100u,                    0u                      },   /* Real-time */
+    { NRFCAN_SHAPE_BULK_SHARE, NRFCAN_SHAPE_BULK_BURST },   /* Bulk      */
+};
+#endif
+
+#if (NRFCAN_USE_PIPES == 1)
+/* Address group of objects with a known consumer, everything else is
+ * broadcast. Directed group is the node id taken from the identifier */
+#define NRFCAN_GROUP_NODE           (0x00u)
+
+static const nrfcan_group_range_t groups[] = {
+    { 0x181, 0x1ff, NRFCAN_GROUP_PDO + 0    },  /* TPDO1     */
+    { 0x201, 0x27f, NRFCAN_GROUP_NODE       },  /* RPDO1     */
+    { 0x281, 0x2ff, NRFCAN_GROUP_PDO + 1    },  /* TPDO2     */
+    { 0x301, 0x37f, NRFCAN_GROUP_NODE       },  /* RPDO2     */
+    { 0x381, 0x3ff, NRFCAN_GROUP_PDO + 2    },  /* TPDO3     */
+    { 0x401, 0x47f, NRFCAN_GROUP_NODE       },  /* RPDO3     */
+    { 0x481, 0x4ff, NRFCAN_GROUP_PDO + 3    },  /* TPDO4     */
+    { 0x501, 0x57f, NRFCAN_GROUP_NODE       },  /* RPDO4     */
+    { 0x581, 0x5ff, NRFCAN_GROUP_SDO_CLIENT },  /* SDO tx    */
+    { 0x601, 0x67f, NRFCAN_GROUP_NODE       },  /* SDO rx    */
+};
+#endif
+
+#if (NRFCAN_USE_HOPPING == 1)
+static const uint8_t hop_channels[NRFCAN_HOP_NUM] = NRFCAN_HOP_CHANNELS;
+#endif
+
+#if (NRFCAN_USE_RATE == 1)
+static const uint16_t rates_kbps[NRFCAN_RATE_NUM] = { 250, 1000, 2000 };
+#endif
+
 const CO_IF_CAN_DRV co_can_nrf24l01 = {
     &DrvCanInit,
     &DrvCanEnable,
@@ -63,57 +328,146 @@ const CO_IF_CAN_DRV co_can_nrf24l01 = {
 static void DrvCanInit(void) {
     nrf24l01_config_t config = { .address = 0xcecececece, .channel = 110, .retr_count = 3, .retr_delay = 250 };
 
+#if (NRFCAN_USE_HOPPING == 1)
+    config.channel = nrf24l01_service_hop_init(&service);
+#endif
+
+#if (NRFCAN_USE_RATE == 1)
+    service.rate = NRFCAN_RATE_INITIAL;
+    service.rate_next = NRFCAN_RATE_INITIAL;
+    service.rate_seq = 0;
+    service.rate_clean = 0;
+    service.rate_master = 0;
+    service.rate_switch = 0;
+    service.rate_heard = 0;
+    service.stats.rate_kbps = rates_kbps[NRFCAN_RATE_INITIAL];
+#endif
+
     nrf24l01_hal_attach(&service.device, &nrf24l01_hal_stm32l4xx);
     nrf24l01_initialize(&service.device);
-    nrf24l01_configure(&service.device, &config);
+    /* Radio was just reset, whatever the shadow holds is stale */
+    memset(&service.config, 0, sizeof(service.config));
+    nrf24l01_service_configure(&service, &config);
 
     if (nrf24l01_probe(&service.device) < 0) {
         HAL_NVIC_SystemReset();
     }
 
-    service.txq = xQueueCreateStatic(16,
-                                     sizeof(nrf24l01_message_t),
-                                     (uint8_t* ) &service.txbuff[0],
-                                     &service.txc);
-    service.rxq = xQueueCreateStatic(16,
-                                     sizeof(nrf24l01_message_t),
-                                     (uint8_t* ) &service.rxbuff[0],
-                                     &service.rxc);
+    service.mode = NRFCAN_MODE_OFF;
+    service.mode_request = 0;
+
+    service.per = 0;
+    service.outcomes = 0;
+    service.retr_pending = 0;
+    service.stats.retr_count = config.retr_count;
+    service.stats.retr_delay = config.retr_delay;
+
+    nrfcan_codec_init(&service.codec, NRFCAN_CODEC_VERSION);
+#if (NRFCAN_USE_FEC == 1)
+    nrfcan_fec_init(&service.fec, NRFCAN_FEC_PARITY);
+#endif
+
+    service.txhead = 0;
+    service.txcount = 0;
+    service.txtag = 0;
+
+    service.rxmsg = 0;
+    service.rxpos = 0;
+    service.rxnext = 0;
+    service.rxtask = 0;
+
+    service.mailbox_count = 0;
+    service.deadline_count = 0;
+    service.mailbox_fresh = 0;
+
+    nrfcan_ring_init(&service.txq, &service.txbuff[0], sizeof(service.txbuff));
+    nrfcan_ring_init(&service.rxq, &service.rxbuff[0], sizeof(service.rxbuff));
+
+    /* Cycle counter is used to measure interrupt and service latency */
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+
+    service.seed = 1;
+    service.stats.tx_slack_min = UINT16_MAX;
+    service.txseq = 0;
+    service.source_next = 0;
+    memset(&service.sources[0], 0, sizeof(service.sources));
+    service.tdma_synced = 0;
+
+#if (NRFCAN_USE_SERVICE_TASK == 1)
+    service.task = xTaskCreateStatic(&nrf24l01_service_task,
+                                     "NRF_SVC",
+                                     NRFCAN_TASK_STACK_SIZE,
+                                     &service,
+                                     NRFCAN_TASK_PRIO,
+                                     &service_stack[0],
+                                     &service_cntrl);
+#endif
 }
 
 static void DrvCanEnable(uint32_t baudrate) {
     (void) baudrate;
-    nrf24l01_notify(&service.device, &nrf24l01_service_on_event, &service);
-    nrf24l01_open(&service.device);
-    nrf24l01_listen(&service.device);
+    nrf24l01_notify(&service.device, &nrf24l01_service_on_irq, &service);
+    nrf24l01_service_request(&service, NRFCAN_REQUEST_OPEN);
+
+    /* Announce supported frame format to peers */
+    nrf24l01_service_hello(&service);
 }
 
 static int16_t DrvCanSend(CO_IF_FRM *frm) {
-    nrf24l01_message_t message;
-    uint8_t index;
-
-    index = 0;
-    message.data[index] = frm->DLC;
-
-    if (frm->Identifier > 0x7ff) {
-        message.data[index++] |= NRFCAN_DLC_EXT_ID;
-        message.data[index++] = ((frm->Identifier >> 24) & 0xff);
-        message.data[index++] = ((frm->Identifier >> 16) & 0xff);
-        message.data[index++] = ((frm->Identifier >> 8 ) & 0xff);
-        message.data[index++] = ( frm->Identifier        & 0xff);
-    } else {
-        message.data[index++] &= ~NRFCAN_DLC_EXT_ID;
-        message.data[index++] = ((frm->Identifier >> 8)  & 0xff);
-        message.data[index++] = ( frm->Identifier        & 0xff);
+    nrf24l01_message_t *message;
+    nrfcan_frame_t      frame;
+    int                 size;
+#if (NRFCAN_USE_COALESCE == 1)
+    uint8_t             coded[NRFCAN_CODEC_FRAME_MAX];
+#endif
+
+    if ((service.codec.version_heard == 0) && ((nrf24l01_service_ticks() - service.hello_at) >= NRFCAN_HELLO_PERIOD)) {
+        /* Announcement or every reply to it got lost, nobody knows about us */
+        nrf24l01_service_hello(&service);
+    }
+
+    frame.identifier = frm->Identifier;
+    frame.dlc = frm->DLC;
+    memcpy(&frame.data[0], &frm->Data[0], sizeof(frame.data));
+
+#if (NRFCAN_USE_COALESCE == 1)
+    if (nrf24l01_service_coalescable(frm->Identifier)) {
+        size = nrfcan_codec_encode(&service.codec, &frame, &coded[0], sizeof(coded));
+        if ((size > 0) && nrf24l01_service_coalesce(&service, &coded[0], size, frame.dlc, nrf24l01_service_deadline(&service, frm->Identifier))) {
+            /* Older value still waiting in the queue was replaced */
+            return sizeof(CO_IF_FRM);
+        }
     }
+#endif
 
-    for (uint8_t i = 0; i < frm->DLC; i++) {
-        message.data[index++] = frm->Data[i];
+    message = nrf24l01_service_alloc(&service);
+    if (message == 0) {
+        return (-1);
     }
 
-    message.size = index;
+    /* Encode straight into the transmit ring slot */
+    size = nrfcan_codec_encode(&service.codec, &frame, &message->data[0], sizeof(message->data));
+    message->size = (size < 0) ? 0 : size;
+    message->tclass = nrf24l01_service_classify(frm->Identifier);
+    message->deadline = nrf24l01_service_deadline(&service, frm->Identifier);
+    message->priority = nrf24l01_service_priority(frm->Identifier);
+#if (NRFCAN_USE_SHAPING == 1)
+    message->shape = nrf24l01_service_shape(frm->Identifier);
+#endif
+#if (NRFCAN_USE_PIPES == 1)
+    message->group = nrf24l01_service_group(frm->Identifier);
+#endif
+    if (frm->Identifier == NRFCAN_TDMA_SYNC_ID) {
+        /* SYNC opens time division frame and is not bound to node slot */
+        message->flags |= NRFCAN_MESSAGE_SYNC;
+#if (NRFCAN_USE_RATE == 1)
+        /* SYNC producer decides data rate of the whole network */
+        service.rate_master = 1;
+#endif
+    }
 
-    if (nrf24l01_service_send(&service, &message) < 0) {
+    if (nrf24l01_service_send(&service, message) < 0) {
         return (-1);
     }
 
@@ -121,110 +475,1897 @@ static int16_t DrvCanSend(CO_IF_FRM *frm) {
 }
 
 static int16_t DrvCanRead(CO_IF_FRM *frm) {
-    nrf24l01_message_t message;
-    uint8_t index;
+    nrfcan_frame_t frame;
 
-    if (nrf24l01_service_recv(&service, &message) < 0) {
-        return (-1);
+    while (1) {
+        while ((service.rxmsg == 0) || (service.rxpos >= service.rxmsg->size)) {
+            if (service.rxmsg != 0) {
+                /* Current payload is exhausted, hand slot back to the radio */
+                nrfcan_ring_release(&service.rxq, service.rxnext, 1);
+                service.rxmsg = 0;
+            }
+#if (NRFCAN_USE_MAILBOX == 1)
+            /* Freshest process data goes out between payloads */
+            if (nrf24l01_service_mailbox_take(&service, &frame)) {
+                goto deliver;
+            }
+#endif
+            /* Wait for next payload, it is decoded in place */
+            service.rxmsg = nrf24l01_service_recv(&service);
+            if (service.rxmsg == 0) {
+                /* Woken up by mailbox */
+                continue;
+            }
+            service.rxpos = 0;
+
+            if (nrfcan_codec_is_control(&service.rxmsg->data[0], service.rxmsg->size)) {
+                nrf24l01_service_on_control(&service, service.rxmsg);
+                service.rxpos = service.rxmsg->size;
+            }
+        }
+
+        if (nrfcan_codec_decode(&service.codec, &service.rxmsg->data[0], service.rxmsg->size, &service.rxpos, service.rxmsg->source, &frame) < 0) {
+            return (-1);
+        }
+#if (NRFCAN_USE_MAILBOX == 1)
+        if (nrf24l01_service_mailbox_find(&service, frame.identifier) >= 0) {
+            /* Already delivered through its mailbox */
+            continue;
+        }
+#endif
+        break;
     }
-    if (message.size < 3) {
-        return (-1);
+
+#if (NRFCAN_USE_MAILBOX == 1)
+deliver:
+#endif
+    frm->Identifier = frame.identifier;
+    frm->DLC = frame.dlc;
+    memcpy(&frm->Data[0], &frame.data[0], frame.dlc);
+
+    return (sizeof(CO_IF_FRM));
+}
+
+static void DrvCanReset(void) {
+    nrf24l01_service_request(&service, NRFCAN_REQUEST_CLOSE | NRFCAN_REQUEST_OPEN);
+}
+
+static void DrvCanClose(void) {
+    /* Close overrides open which was not applied yet */
+    __sync_fetch_and_and(&service.mode_request, (uint8_t) ~NRFCAN_REQUEST_OPEN);
+    nrf24l01_service_request(&service, NRFCAN_REQUEST_CLOSE);
+}
+
+static TickType_t nrf24l01_service_ticks(void) {
+#if (NRFCAN_USE_SERVICE_TASK == 1)
+    return xTaskGetTickCount();
+#else
+    return xTaskGetTickCountFromISR();
+#endif
+}
+
+static void nrf24l01_service_switched(nrf24l01_service_t *svc, nrfcan_mode_t mode) {
+    svc->stats.mode_switches++;
+    if ((mode == NRFCAN_MODE_LISTEN) || (mode == NRFCAN_MODE_TRANSMIT)) {
+        /* Synthesizer has to settle before radio receives or transmits anything */
+        svc->settle_us += NRFCAN_SETTLE_US;
+        svc->stats.settle_us += NRFCAN_SETTLE_US;
     }
+    svc->mode = mode;
+}
 
-    if (message.data[0] & NRFCAN_DLC_EXT_ID) {
-        index = 5;
-        frm->DLC = message.data[0] & ~(NRFCAN_DLC_EXT_ID);
-        frm->Identifier = (message.data[1] << 24) |
-                          (message.data[2] << 16) |
-                          (message.data[3] << 8 ) |
-                          (message.data[4]      ) ;
+static void nrf24l01_service_mode(nrf24l01_service_t *svc, nrfcan_mode_t mode) {
+    if (svc->mode == mode) {
+        /* Radio is already there, nothing to write */
+        return;
+    }
+    if (mode == NRFCAN_MODE_OFF) {
+        nrf24l01_close(&svc->device);
+        svc->commands++;
     } else {
-        index = 3;
-        frm->DLC = message.data[0];
-        frm->Identifier = (message.data[1] << 8 ) |
-                          (message.data[2]      ) ;
+        if ((svc->mode == NRFCAN_MODE_OFF) || (svc->mode == NRFCAN_MODE_UNKNOWN)) {
+            nrf24l01_open(&svc->device);
+            svc->commands++;
+        }
+        if (mode == NRFCAN_MODE_STANDBY) {
+            nrf24l01_standby(&svc->device);
+        } else {
+            nrf24l01_listen(&svc->device);
+        }
+        svc->commands++;
     }
+#if (NRFCAN_USE_PIPES == 1)
+    nrf24l01_service_pipe0(svc, mode);
+#endif
+    nrf24l01_service_switched(svc, mode);
+}
 
-    for (uint8_t i = 0; i < frm->DLC; i++) {
-        frm->Data[i] = message.data[index++];
+static void nrf24l01_service_configure(nrf24l01_service_t *svc, const nrf24l01_config_t *config) {
+    if ((svc->config.address    == config->address   ) &&
+        (svc->config.channel    == config->channel   ) &&
+        (svc->config.retr_count == config->retr_count) &&
+        (svc->config.retr_delay == config->retr_delay)) {
+        return;
     }
+    svc->config = *config;
+    nrf24l01_configure(&svc->device, &svc->config);
+    svc->commands++;
+#if (NRFCAN_USE_PIPES == 1)
+    /* Configuration sets the single default address */
+    nrf24l01_service_pipes(svc);
+#endif
+#if (NRFCAN_USE_RATE == 1)
+    /* Configuration may bring radio back to its default rate */
+    nrf24l01_data_rate(&svc->device, rates_kbps[svc->rate]);
+    svc->commands++;
+#endif
+}
 
-    return (sizeof(CO_IF_FRM));
+static void nrf24l01_service_resync(nrf24l01_service_t *svc) {
+    nrfcan_mode_t mode = svc->mode;
+
+    /* Radio lost its registers, write whole shadow back */
+    nrf24l01_initialize(&svc->device);
+    nrf24l01_configure(&svc->device, &svc->config);
+    svc->commands += 2;
+#if (NRFCAN_USE_PIPES == 1)
+    nrf24l01_service_pipes(svc);
+#endif
+#if (NRFCAN_USE_RATE == 1)
+    nrf24l01_data_rate(&svc->device, rates_kbps[svc->rate]);
+    svc->commands++;
+#endif
+    /* Payloads in flight were lost with the registers, send them again */
+    while (svc->txcount > 0) {
+        nrf24l01_service_settle(svc, 0);
+    }
+    svc->mode = NRFCAN_MODE_UNKNOWN;
+    svc->stats.resyncs++;
+    if (nrf24l01_probe(&svc->device) < 0) {
+        /* Radio is still not there, next health check tries again */
+        svc->stats.resync_failed++;
+        return;
+    }
+    nrf24l01_service_mode(svc, (mode == NRFCAN_MODE_OFF) ? NRFCAN_MODE_OFF : NRFCAN_MODE_LISTEN);
 }
 
-static void DrvCanReset(void) {
-    DrvCanClose();
-    DrvCanEnable(0);
+static void nrf24l01_service_health(nrf24l01_service_t *svc) {
+    uint8_t config;
+    uint8_t expect;
+
+    config = nrf24l01_read_register(&svc->device, NRFCAN_REG_CONFIG);
+    svc->commands++;
+    if (config == 0xff) {
+        /* Nobody drives MISO, single read proves nothing */
+        svc->stats.health_no_answer++;
+        return;
+    }
+    switch (svc->mode) {
+    case NRFCAN_MODE_OFF:
+        expect = 0;
+        break;
+    case NRFCAN_MODE_LISTEN:
+        expect = NRFCAN_CONFIG_PWR_UP | NRFCAN_CONFIG_PRIM_RX;
+        break;
+    case NRFCAN_MODE_STANDBY:
+    case NRFCAN_MODE_TRANSMIT:
+        expect = NRFCAN_CONFIG_PWR_UP;
+        break;
+    default:
+        /* Earlier resync did not finish */
+        nrf24l01_service_resync(svc);
+        return;
+    }
+    if ((config & (NRFCAN_CONFIG_PWR_UP | NRFCAN_CONFIG_PRIM_RX)) != expect) {
+        /* Radio went through reset behind our back */
+        nrf24l01_service_resync(svc);
+    }
 }
 
-static void DrvCanClose(void) {
-    nrf24l01_close(&service.device);
+static void nrf24l01_service_request(nrf24l01_service_t *svc, uint8_t request) {
+    /* Radio and mode shadow belong to the service, callers only post */
+    __sync_fetch_and_or(&svc->mode_request, request);
+    nrf24l01_service_kick(svc);
+}
+
+static void nrf24l01_service_on_request(nrf24l01_service_t *svc) {
+    uint8_t request = __sync_fetch_and_and(&svc->mode_request, 0);
+
+    if (request & NRFCAN_REQUEST_CLOSE) {
+        /* Payloads left in radio fifo go back to backlog */
+        if (svc->txcount > 0) {
+            nrf24l01_flush_tx(&svc->device);
+            svc->commands++;
+        }
+        while (svc->txcount > 0) {
+            nrf24l01_service_settle(svc, 0);
+        }
+        nrf24l01_service_mode(svc, NRFCAN_MODE_OFF);
+    }
+    if (request & NRFCAN_REQUEST_OPEN) {
+#if (NRFCAN_USE_PIPES == 1)
+        /* Node id and groups are known by now */
+        nrf24l01_service_pipes(svc);
+#endif
+        nrf24l01_service_mode(svc, NRFCAN_MODE_LISTEN);
+    }
+}
+
+static nrf24l01_message_t* nrf24l01_service_alloc(struct nrf24l01_service *svc) {
+    nrf24l01_message_t *message;
+
+    /* Transmit ring is filled from several tasks, keep them apart
+     * without masking the radio interrupt */
+    if (xTaskGetSchedulerState() != taskSCHEDULER_NOT_STARTED) {
+        vTaskSuspendAll();
+    }
+    message = nrfcan_ring_reserve(&svc->txq, sizeof(nrf24l01_message_t));
+    if (message != 0) {
+        message->flags = 0;
+        message->deadline = nrf24l01_service_deadline(svc, 0);
+        /* Link control goes first */
+        message->priority = 0;
+        message->shape = NRFCAN_SHAPE_REALTIME;
+        message->group = NRFCAN_GROUP_BROADCAST;
+    } else if (xTaskGetSchedulerState() != taskSCHEDULER_NOT_STARTED) {
+        xTaskResumeAll();
+    }
+    return message;
 }
 
 static int nrf24l01_service_send(struct nrf24l01_service *svc, nrf24l01_message_t *message) {
+    int ret = (message->size > 0) ? 0 : -1;
 
-    if (xQueueSend(svc->txq, message, 0) == pdTRUE) {
-        nrf24l01_trigger_irq(&svc->device);
-        return (0);
+    /* Slot has to be committed anyway to keep producer lock balanced,
+     * empty message is skipped by the service */
+    nrfcan_ring_commit(&svc->txq, NRFCAN_MESSAGE_LENGTH(message));
+    if (xTaskGetSchedulerState() != taskSCHEDULER_NOT_STARTED) {
+        xTaskResumeAll();
     }
-    return (-1);
+    nrf24l01_service_kick(svc);
+    return ret;
+}
+
+static void nrf24l01_service_hello(nrf24l01_service_t *svc) {
+    nrf24l01_message_t *message;
+
+    svc->hello_at = nrf24l01_service_ticks();
+    message = nrf24l01_service_alloc(svc);
+    if (message != 0) {
+        message->size = nrfcan_codec_hello(&svc->codec, NRFCAN_CODEC_HELLO, &message->data[0], sizeof(message->data));
+        message->tclass = NRFCAN_CLASS_ACKED;
+        nrf24l01_service_send(svc, message);
+    }
+}
+
+static nrf24l01_payload_t* nrf24l01_service_recv(struct nrf24l01_service *svc) {
+    nrf24l01_payload_t *message;
+    uint8_t             length;
+
+    svc->rxtask = xTaskGetCurrentTaskHandle();
+    while (1) {
+        svc->rxnext = nrfcan_ring_cursor(&svc->rxq);
+        message = nrfcan_ring_peek(&svc->rxq, &svc->rxnext, &length);
+        if (message != 0) {
+            return message;
+        }
+#if (NRFCAN_USE_MAILBOX == 1)
+        for (uint8_t i = 0; i < svc->mailbox_count; i++) {
+            if (svc->mailboxes[i].pending) {
+                return 0;
+            }
+        }
+#endif
+        /* Blocking is ensured by notification from radio service */
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    }
+}
+
+static uint8_t nrf24l01_service_classify(uint32_t identifier) {
+    for (uint8_t i = 0; i < (sizeof(classes) / sizeof(classes[0])); i++) {
+        if ((identifier >= classes[i].first) && (identifier <= classes[i].last)) {
+            return classes[i].tclass;
+        }
+    }
+    return NRFCAN_CLASS_ACKED;
+}
+
+#if (NRFCAN_USE_COALESCE == 1)
+static int nrf24l01_service_coalescable(uint32_t identifier) {
+    for (uint8_t i = 0; i < (sizeof(coalesced) / sizeof(coalesced[0])); i++) {
+        if ((identifier >= coalesced[i].first) && (identifier <= coalesced[i].last)) {
+            return (1);
+        }
+    }
+    return (0);
+}
+
+static int nrf24l01_service_coalesce(nrf24l01_service_t *svc, const uint8_t *buf, uint8_t size, uint8_t dlc, uint16_t deadline) {
+    nrf24l01_message_t *message;
+    uint16_t            cursor;
+    uint8_t             length;
+    int                 found = 0;
+
+    /* Queued record must not be taken by the service while it is rewritten */
+    if (xTaskGetSchedulerState() != taskSCHEDULER_NOT_STARTED) {
+        vTaskSuspendAll();
+    }
+#if (NRFCAN_USE_SERVICE_TASK == 0)
+    taskENTER_CRITICAL();
+#endif
+    cursor = nrfcan_ring_cursor(&svc->txq);
+    while ((message = nrfcan_ring_peek(&svc->txq, &cursor, &length)) != 0) {
+        /* Same identifier and length encode to the same header, only data differs */
+        if ((message->size == size) && (message->flags == 0) &&
+            (memcmp(&message->data[0], &buf[0], size - dlc) == 0)) {
+            memcpy(&message->data[size - dlc], &buf[size - dlc], dlc);
+            message->deadline = deadline;
+            svc->stats.tx_coalesced[message->tclass]++;
+            found = 1;
+            break;
+        }
+    }
+#if (NRFCAN_USE_SERVICE_TASK == 0)
+    taskEXIT_CRITICAL();
+#endif
+    if (xTaskGetSchedulerState() != taskSCHEDULER_NOT_STARTED) {
+        xTaskResumeAll();
+    }
+    return found;
+}
+#endif
+
+static uint16_t nrf24l01_service_deadline(nrf24l01_service_t *svc, uint32_t identifier) {
+    TickType_t lifetime = NRFCAN_DEADLINE_SDO;
+
+    for (uint8_t i = 0; i < svc->deadline_count; i++) {
+        if ((identifier >= svc->deadline_ranges[i].first) && (identifier <= svc->deadline_ranges[i].last)) {
+            return (uint16_t) (nrf24l01_service_ticks() + svc->deadline_ranges[i].lifetime);
+        }
+    }
+    for (uint8_t i = 0; i < (sizeof(deadlines) / sizeof(deadlines[0])); i++) {
+        if ((identifier >= deadlines[i].first) && (identifier <= deadlines[i].last)) {
+            lifetime = deadlines[i].lifetime;
+            break;
+        }
+    }
+    return (uint16_t) (nrf24l01_service_ticks() + lifetime);
+}
+
+static uint16_t nrf24l01_service_priority(uint32_t identifier) {
+    /* Base identifier decides arbitration, standard frame wins over
+     * extended one with the same base */
+    if (identifier > 0x7ff) {
+        return (uint16_t) ((((identifier >> 18) & 0x7ff) << 1) | 1);
+    }
+    return (uint16_t) (identifier << 1);
+}
+
+static int nrf24l01_service_before(const nrf24l01_message_t *message, const nrf24l01_message_t *other) {
+#if (NRFCAN_TX_ORDER == NRFCAN_ORDER_IDENTIFIER)
+    if (message->priority != other->priority) {
+        return (message->priority < other->priority);
+    }
+#endif
+#if (NRFCAN_USE_DEADLINE == 1)
+    return ((int16_t) (message->deadline - other->deadline) < 0);
+#else
+    /* Queue order */
+    (void) message;
+    (void) other;
+    return (0);
+#endif
+}
+
+static void nrf24l01_service_reclaim(nrf24l01_service_t *svc) {
+    nrf24l01_message_t *message;
+    uint16_t            cursor = nrfcan_ring_cursor(&svc->txq);
+    uint16_t            release = cursor;
+    uint16_t            count = 0;
+    uint8_t             length;
+
+    /* Hand back every finished record in front of the first pending one */
+    while ((message = nrfcan_ring_peek(&svc->txq, &cursor, &length)) != 0) {
+        if (!(message->flags & NRFCAN_MESSAGE_DONE)) {
+            break;
+        }
+        release = cursor;
+        count++;
+    }
+    if (count > 0) {
+        nrfcan_ring_release(&svc->txq, release, count);
+    }
+}
+
+static nrf24l01_message_t* nrf24l01_service_pick(nrf24l01_service_t *svc, TickType_t now, uint16_t *after) {
+    nrf24l01_message_t *message;
+    nrf24l01_message_t *best = 0;
+    uint16_t            cursor = nrfcan_ring_cursor(&svc->txq);
+    uint8_t             length;
+
+    (void) now;
+#if (NRFCAN_USE_SHAPING == 1)
+    nrf24l01_service_refill(svc, now);
+#endif
+    /* Whole backlog is looked at, so frame which wins does not wait for
+     * anything queued before it */
+    while ((message = nrfcan_ring_peek(&svc->txq, &cursor, &length)) != 0) {
+        if (message->flags & NRFCAN_MESSAGE_TAKEN) {
+            continue;
+        }
+        if (message->size == 0) {
+            /* Drop message which failed to encode */
+            message->flags |= NRFCAN_MESSAGE_DONE;
+            continue;
+        }
+#if (NRFCAN_USE_DEADLINE == 1)
+        if ((int16_t) (message->deadline - (uint16_t) now) < 0) {
+            /* Nobody is interested in this value anymore */
+            svc->stats.tx_expired[message->tclass]++;
+            message->flags |= NRFCAN_MESSAGE_DONE;
+            continue;
+        }
+#endif
+#if (NRFCAN_USE_SHAPING == 1)
+        if (!nrf24l01_service_budget(svc, message)) {
+            /* Class used up its share, the rest of backlog goes first */
+            continue;
+        }
+#endif
+        if ((best == 0) || nrf24l01_service_before(message, best)) {
+            best = message;
+            *after = cursor;
+        }
+    }
+    nrf24l01_service_reclaim(svc);
+    return best;
+}
+
+#if (NRFCAN_USE_SHAPING == 1)
+static uint8_t nrf24l01_service_shape(uint32_t identifier) {
+    for (uint8_t i = 0; i < (sizeof(bulk) / sizeof(bulk[0])); i++) {
+        if ((identifier >= bulk[i].first) && (identifier <= bulk[i].last)) {
+            return NRFCAN_SHAPE_BULK;
+        }
+    }
+    return NRFCAN_SHAPE_REALTIME;
+}
+
+static void nrf24l01_service_refill(nrf24l01_service_t *svc, TickType_t now) {
+    int64_t elapsed;
+    int64_t tokens;
+
+    if (now == svc->shape_refill) {
+        return;
+    }
+    elapsed = (int64_t) (now - svc->shape_refill) * (1000000 / configTICK_RATE_HZ);
+    svc->shape_refill = now;
+    for (uint8_t i = 0; i < NRFCAN_SHAPE_NUM; i++) {
+        if (budgets[i].share >= 100u) {
+            continue;
+        }
+        /* Tokens are microseconds of airtime, class earns its share of
+         * elapsed time up to one burst */
+        tokens = svc->shape_tokens[i] + ((elapsed * budgets[i].share) / 100);
+        if (tokens > (int64_t) budgets[i].burst) {
+            tokens = budgets[i].burst;
+        }
+        svc->shape_tokens[i] = (int32_t) tokens;
+    }
+}
+
+static int nrf24l01_service_budget(nrf24l01_service_t *svc, nrf24l01_message_t *message) {
+    if ((budgets[message->shape].share >= 100u) || (svc->shape_tokens[message->shape] > 0)) {
+        return (1);
+    }
+    if (!(message->flags & NRFCAN_MESSAGE_SHAPED)) {
+        /* Counted once per frame however long it waits */
+        message->flags |= NRFCAN_MESSAGE_SHAPED;
+        svc->stats.tx_shaped[message->shape]++;
+    }
+    return (0);
+}
+
+static void nrf24l01_service_charge(nrf24l01_service_t *svc, uint8_t shape, uint8_t bytes) {
+    uint32_t airtime;
+
+#if (NRFCAN_USE_RATE == 1)
+    airtime = ((uint32_t) bytes * 8000u) / rates_kbps[svc->rate];
+#else
+    airtime = ((uint32_t) bytes * 8000u) / NRFCAN_SHAPE_KBPS;
+#endif
+    /* First attempt only, budget may go negative by the last payload */
+    svc->stats.tx_airtime_us[shape] += airtime;
+    if (budgets[shape].share < 100u) {
+        svc->shape_tokens[shape] -= (int32_t) airtime;
+    }
+}
+#endif
+
+#if (NRFCAN_USE_PIPES == 1)
+static uint8_t nrf24l01_service_group(uint32_t identifier) {
+    for (uint8_t i = 0; i < (sizeof(groups) / sizeof(groups[0])); i++) {
+        if ((identifier >= groups[i].first) && (identifier <= groups[i].last)) {
+            if (groups[i].group == NRFCAN_GROUP_NODE) {
+                return (uint8_t) (identifier & 0x7f);
+            }
+            return groups[i].group;
+        }
+    }
+    return NRFCAN_GROUP_BROADCAST;
+}
+
+static void nrf24l01_service_pipes(nrf24l01_service_t *svc) {
+    /* Pipes 1 to 5 share all but the lowest address byte */
+    uint64_t base = svc->config.address & ~((uint64_t) 0xff);
+
+    nrf24l01_pipe_open(&svc->device, 1, base | NRFCAN_GROUP_BROADCAST);
+    nrf24l01_pipe_open(&svc->device, 2, base | svc->node_id);
+    svc->commands += 2;
+    for (uint8_t i = 0; i < svc->pipe_count; i++) {
+        nrf24l01_pipe_open(&svc->device, NRFCAN_PIPE_FIRST_GROUP + i, base | svc->pipe_groups[i]);
+        svc->commands++;
+    }
+    if (svc->pipe_tx != 0) {
+        /* Keep payloads already in radio fifo going where they were headed */
+        nrf24l01_tx_address(&svc->device, base | svc->pipe_tx);
+        svc->commands++;
+    }
+    /* Configuration may have enabled pipe 0 again */
+    svc->pipe0_open = 1;
+    nrf24l01_service_pipe0(svc, svc->mode);
+}
+
+static uint8_t nrf24l01_service_listened(nrf24l01_service_t *svc, uint8_t group) {
+    if ((group == NRFCAN_GROUP_BROADCAST) || (group == svc->node_id)) {
+        return (1);
+    }
+    for (uint8_t i = 0; i < svc->pipe_count; i++) {
+        if (svc->pipe_groups[i] == group) {
+            return (1);
+        }
+    }
+    return (0);
 }
 
-static int nrf24l01_service_recv(struct nrf24l01_service *svc, nrf24l01_message_t *message) {
+static void nrf24l01_service_pipe0(nrf24l01_service_t *svc, nrfcan_mode_t mode) {
+    /* Pipe 0 receives acknowledgments while transmitting, when listening it
+     * would acknowledge traffic headed to another node in its name */
+    uint8_t open = (mode == NRFCAN_MODE_TRANSMIT) || ((svc->pipe_tx != 0) && nrf24l01_service_listened(svc, svc->pipe_tx));
 
-    if (xQueueReceive(svc->rxq, message, portMAX_DELAY) == pdTRUE) {
+    if (open == svc->pipe0_open) {
+        return;
+    }
+    if (open) {
+        /* Before first redirect radio transmits to configured address */
+        nrf24l01_pipe_open(&svc->device, 0, (svc->pipe_tx != 0) ? ((svc->config.address & ~((uint64_t) 0xff)) | svc->pipe_tx) : svc->config.address);
+    } else {
+        nrf24l01_pipe_close(&svc->device, 0);
+    }
+    svc->commands++;
+    svc->pipe0_open = open;
+}
+
+static int nrf24l01_service_redirect(nrf24l01_service_t *svc, const nrf24l01_message_t *message) {
+    if (message->group == svc->pipe_tx) {
+        return (1);
+    }
+    if (svc->txcount > 0) {
+        /* Payloads in radio fifo go to the current address, wait for them */
         return (0);
     }
-    return (-1);
+    svc->pipe_tx = message->group;
+    nrf24l01_tx_address(&svc->device, (svc->config.address & ~((uint64_t) 0xff)) | svc->pipe_tx);
+    svc->commands++;
+    /* Address of pipe 0 followed, it may not be ours any more */
+    nrf24l01_service_pipe0(svc, svc->mode);
+    svc->stats.tx_redirects++;
+    return (1);
 }
+#endif
 
-static void nrf24l01_service_on_event(void *context) {
-    BaseType_t          xHigherPriorityTaskWoken = pdFALSE;
-    nrf24l01_service_t *svc = (nrf24l01_service_t*) (context);
-    nrf24l01_message_t  message;
-    uint8_t             status;
+static void nrf24l01_service_write(nrf24l01_service_t *svc, nrf24l01_message_t *message) {
+#if (NRFCAN_LINK_HEADER > 0) || (NRFCAN_LINK_PARITY > 0)
+    nrf24l01_message_t  framed;
+#if (NRFCAN_USE_FEC == 1)
+    int                 size;
+#endif
 
-    /* Set device to standby mode to disable its clock */
-    nrf24l01_standby(&svc->device);
-    /* Read and clear status register */
-    status = nrf24l01_clear_status(&svc->device);
-    /* Start listening in order to acquire channel activity measurement */
-    nrf24l01_listen(&svc->device);
+    /* Ring slot holds only used part of the payload, link header and
+     * parity are added around a copy */
+    framed.size = 0;
+#if (NRFCAN_USE_SEQUENCE == 1)
+    if (nrfcan_codec_is_v2(&message->data[0], message->size) || nrfcan_codec_is_control(&message->data[0], message->size)) {
+        /* V1 payloads stay readable by nodes which know nothing about link
+         * header, V2 is only sent once every peer announced it */
+        framed.size = nrfcan_codec_link(svc->node_id, svc->txseq++, &framed.data[0], sizeof(framed.data));
+    }
+#endif
+    memcpy(&framed.data[framed.size], &message->data[0], message->size);
+    framed.size += message->size;
+#if (NRFCAN_USE_FEC == 1)
+    size = nrfcan_fec_encode(&svc->fec, &framed.data[0], framed.size, sizeof(framed.data));
+    if (size > 0) {
+        framed.size = size;
+    }
+#endif
+    framed.tclass = message->tclass;
+    framed.flags = message->flags;
+    message = &framed;
+#endif
+    /* Remember class of each payload in flight for completion accounting,
+     * its records carry the tag of this write */
+    svc->txslot[(svc->txhead + svc->txcount) % NRFCAN_TX_FIFO_DEPTH] = message->tclass;
+    svc->txcount++;
+    svc->txtag++;
+#if (NRFCAN_USE_NOACK == 1)
+    if (message->tclass == NRFCAN_CLASS_BROADCAST) {
+        nrf24l01_write_noack(&svc->device, &message->data[0], message->size);
+        svc->commands++;
+        if (svc->mode != NRFCAN_MODE_TRANSMIT) {
+            nrf24l01_service_switched(svc, NRFCAN_MODE_TRANSMIT);
+        }
+        return;
+    }
+#endif
+#if (NRFCAN_USE_PIPES == 1)
+    /* Acknowledgment comes back through pipe 0 */
+    nrf24l01_service_pipe0(svc, NRFCAN_MODE_TRANSMIT);
+#endif
+    nrf24l01_write(&svc->device, &message->data[0], message->size);
+    svc->commands++;
+    /* Driver switches radio to transmitter on its own */
+    if (svc->mode != NRFCAN_MODE_TRANSMIT) {
+        nrf24l01_service_switched(svc, NRFCAN_MODE_TRANSMIT);
+    }
+}
 
-    if (status & NRF24L01_STATUS_RX_DR) {
-        /* Read all pending messages */
-        while (nrf24l01_rx_pending(&svc->device) > 0) {
-            /* Fetch message from device */
-            nrf24l01_read(&svc->device, &message.data[0], &message.size);
-            if (xQueueSendFromISR(svc->rxq, &message, &xHigherPriorityTaskWoken) != pdFALSE) {
-                /* Reception complete */
-                svc->stats.rx_complete++;
-            } else {
-                /* Queue is full, message is lost */
-                svc->stats.rx_lost++;
+static int nrf24l01_service_accept(nrf24l01_service_t *svc, nrf24l01_payload_t *message) {
+    uint8_t source = 0;
+    uint8_t seq = 0;
+    int     link;
+
+    /* Every stage is optional */
+    (void) svc;
+#if (NRFCAN_USE_FEC == 1)
+    if (nrf24l01_service_repair(svc, message) < 0) {
+        return (-1);
+    }
+#endif
+    /* Link header is understood whether this node sends one or not,
+     * sender is known only from it */
+    link = nrfcan_codec_on_link(&message->data[0], &message->size, &source, &seq);
+    if (link < 0) {
+        return (-1);
+    }
+    message->source = source;
+#if (NRFCAN_USE_SEQUENCE == 1)
+    if ((link > 0) && nrf24l01_service_duplicate(svc, source, seq, message)) {
+        svc->stats.rx_duplicates++;
+        return (-1);
+    }
+#else
+    (void) seq;
+#endif
+#if (NRFCAN_USE_RATE == 1)
+    svc->rate_heard = nrf24l01_service_ticks();
+#endif
+#if (NRFCAN_USE_SYNC == 1)
+    nrf24l01_service_on_sync(svc, message);
+#endif
+#if (NRFCAN_USE_RATE == 1)
+    nrf24l01_service_on_rate(svc, message);
+#endif
+#if (NRFCAN_USE_SORT == 1)
+    if (nrf24l01_service_sort(svc, message) == 0) {
+        /* Everything went to mailboxes or was filtered out, payload needs
+         * no ring space */
+        return (0);
+    }
+#endif
+    return (1);
+}
+
+#if (NRFCAN_USE_SORT == 1)
+static uint8_t nrf24l01_service_sort(nrf24l01_service_t *svc, nrf24l01_payload_t *message) {
+    nrfcan_frame_t frame;
+    uint8_t        pos = 0;
+    uint8_t        others = 0;
+#if (NRFCAN_USE_MAILBOX == 1)
+    int            index;
+#endif
+#if (NRFCAN_USE_ACCEPT == 1)
+    uint8_t        start;
+    int            next;
+#endif
+
+    if (nrfcan_codec_is_control(&message->data[0], message->size)) {
+        return (1);
+    }
+#if (NRFCAN_USE_MAILBOX == 1) && (NRFCAN_USE_ACCEPT == 1)
+    if ((svc->mailbox_count == 0) && !svc->accept_active) {
+        return (1);
+    }
+#elif (NRFCAN_USE_MAILBOX == 1)
+    if (svc->mailbox_count == 0) {
+        return (1);
+    }
+#else
+    if (!svc->accept_active) {
+        return (1);
+    }
+#endif
+    while (pos < message->size) {
+#if (NRFCAN_USE_ACCEPT == 1)
+        start = pos;
+#endif
+        if (nrfcan_codec_decode(&svc->codec, &message->data[0], message->size, &pos, message->source, &frame) < 0) {
+            /* Let the reader deal with the malformed rest */
+            return (1);
+        }
+#if (NRFCAN_USE_MAILBOX == 1)
+        index = nrf24l01_service_mailbox_find(svc, frame.identifier);
+        if (index >= 0) {
+            nrf24l01_service_mailbox_put(svc, index, &frame);
+            continue;
+        }
+#endif
+#if (NRFCAN_USE_ACCEPT == 1)
+        if (!nrf24l01_service_wanted(svc, frame.identifier)) {
+            /* Cut the frame out, reader never sees it */
+            next = nrfcan_codec_remove(&message->data[0], &message->size, start, pos);
+            if (next < 0) {
+                return (1);
             }
+            pos = (uint8_t) next;
+            svc->stats.rx_filtered++;
+            continue;
         }
+#endif
+        others++;
     }
-    if (status & NRF24L01_STATUS_MAX_RT) {
-        /* Flush devices tx fifo in order to release failed transmission */
-        nrf24l01_flush_tx(&svc->device);
-        svc->stats.tx_lost++;
+    return others;
+}
+#endif
+
+#if (NRFCAN_USE_ACCEPT == 1)
+static uint8_t nrf24l01_service_ext_slot(uint32_t identifier) {
+    return (uint8_t) ((identifier ^ (identifier >> 11) ^ (identifier >> 22)) & (NRFCAN_ACCEPT_EXT_NUM - 1));
+}
+
+static int nrf24l01_service_wanted(nrf24l01_service_t *svc, uint32_t identifier) {
+    uint8_t slot;
+
+    if (identifier <= 0x7ff) {
+        return ((svc->accept_std[identifier >> 5] >> (identifier & 0x1f)) & 1);
     }
-    if (status & NRF24L01_STATUS_TX_DS) {
-        /* Transmission complete */
-        svc->stats.tx_complete++;
-    }
-    if (uxQueueMessagesWaitingFromISR(svc->txq) > 0) {
-        /* Outgoing messages available, check channel availability */
-        if (nrf24l01_channel_available(&svc->device)) {
-            /* Fetch outgoing message from queue and transmit */
-            xQueueReceiveFromISR(svc->txq, &message, &xHigherPriorityTaskWoken);
-            nrf24l01_write(&svc->device, &message.data[0], message.size);
-        } else {
-            /* Channel is not available, postpone transmission */
-            svc->stats.tx_postponed++;
+    if (svc->accept_ext_all) {
+        return (1);
+    }
+    /* Open addressing, empty slot ends the probe */
+    slot = nrf24l01_service_ext_slot(identifier);
+    for (uint8_t i = 0; i < NRFCAN_ACCEPT_EXT_NUM; i++) {
+        if (svc->accept_ext[slot] == identifier) {
+            return (1);
+        }
+        if (svc->accept_ext[slot] == 0) {
+            break;
         }
+        slot = (slot + 1) & (NRFCAN_ACCEPT_EXT_NUM - 1);
     }
+    return (0);
+}
+#endif
 
-    portYIELD_FROM_ISR(xHigherPriorityTaskWoken);
+#if (NRFCAN_USE_MAILBOX == 1)
+static int nrf24l01_service_mailbox_find(nrf24l01_service_t *svc, uint32_t identifier) {
+    for (uint8_t i = 0; i < svc->mailbox_count; i++) {
+        if (svc->mailboxes[i].identifier == identifier) {
+            return (i);
+        }
+    }
+    return (-1);
+}
+
+static void nrf24l01_service_mailbox_put(nrf24l01_service_t *svc, int index, const nrfcan_frame_t *frame) {
+    nrfcan_mailbox_t *mailbox = &svc->mailboxes[index];
+
+    if (mailbox->pending) {
+        /* Older value was never read, it is stale now anyway */
+        svc->stats.rx_overwritten++;
+    }
+    /* Odd version tells reader that copy is in progress */
+    mailbox->version++;
+    NRFCAN_BARRIER();
+    mailbox->frame = *frame;
+    NRFCAN_BARRIER();
+    mailbox->version++;
+    mailbox->pending = 1;
+    svc->mailbox_fresh = 1;
+    svc->stats.rx_mailbox++;
+}
+
+static int nrf24l01_service_mailbox_take(nrf24l01_service_t *svc, nrfcan_frame_t *frame) {
+    nrfcan_mailbox_t *mailbox;
+    uint8_t           version;
+
+    for (uint8_t i = 0; i < svc->mailbox_count; i++) {
+        mailbox = &svc->mailboxes[i];
+        if (!mailbox->pending) {
+            continue;
+        }
+        /* Cleared first, value written meanwhile stays pending */
+        mailbox->pending = 0;
+        do {
+            version = mailbox->version;
+            NRFCAN_BARRIER();
+            *frame = mailbox->frame;
+            NRFCAN_BARRIER();
+        } while ((version & 1) || (version != mailbox->version));
+        return (1);
+    }
+    return (0);
+}
+#endif
+
+#if (NRFCAN_USE_FEC == 1)
+static int nrf24l01_service_repair(nrf24l01_service_t *svc, nrf24l01_payload_t *message) {
+    int ret;
+
+    /* Decoded in place before anybody parses the payload */
+    ret = nrfcan_fec_decode(&svc->fec, &message->data[0], message->size);
+    if (ret < 0) {
+        svc->stats.fec_failed++;
+        return (-1);
+    }
+    if (ret > 0) {
+        svc->stats.fec_corrected += ret;
+        svc->stats.fec_repaired++;
+    }
+    message->size -= NRFCAN_FEC_PARITY;
+    return (0);
+}
+#endif
+
+#if (NRFCAN_USE_SEQUENCE == 1)
+static int nrf24l01_service_duplicate(nrf24l01_service_t *svc, uint8_t source, uint8_t seq, const nrf24l01_payload_t *message) {
+    nrfcan_source_t *entry = 0;
+    uint8_t          distance;
+
+    for (uint8_t i = 0; i < NRFCAN_SEQ_SOURCES; i++) {
+        if (svc->sources[i].valid && (svc->sources[i].source == source)) {
+            entry = &svc->sources[i];
+            break;
+        }
+    }
+    if ((entry != 0) && nrfcan_codec_is_control(&message->data[0], message->size) &&
+        (message->data[1] == NRFCAN_CODEC_HELLO)) {
+        /* Peer announces itself once enabled, it restarted and its sequence
+         * numbers start over within the old window */
+        entry->last = seq;
+        entry->window = 1;
+        return (0);
+    }
+    if (entry == 0) {
+        /* First payload from this peer */
+        entry = &svc->sources[svc->source_next];
+        svc->source_next = (svc->source_next + 1) % NRFCAN_SEQ_SOURCES;
+        entry->source = source;
+        entry->valid = 1;
+        entry->last = seq;
+        entry->window = 1;
+        return (0);
+    }
+
+    distance = (seq - entry->last) & (NRFCAN_CODEC_SEQ_NUM - 1);
+    if ((distance > 0) && (distance < NRFCAN_SEQ_WINDOW)) {
+        /* Newest payload so far, slide the window */
+        entry->window = (entry->window << distance) | 1;
+        entry->last = seq;
+        return (0);
+    }
+    distance = (entry->last - seq) & (NRFCAN_CODEC_SEQ_NUM - 1);
+    if (distance >= NRFCAN_SEQ_WINDOW) {
+        /* Far from the window, peer has most likely restarted */
+        entry->last = seq;
+        entry->window = 1;
+        return (0);
+    }
+    if (entry->window & (1ul << distance)) {
+        /* Sender retransmitted payload whose ACK was lost */
+        return (1);
+    }
+    entry->window |= (1ul << distance);
+    return (0);
+}
+#endif
+
+static void nrf24l01_service_settle(nrf24l01_service_t *svc, uint8_t done) {
+    nrf24l01_message_t *message;
+    uint16_t            cursor = nrfcan_ring_cursor(&svc->txq);
+    uint8_t             tag = svc->txtag - svc->txcount;
+    uint8_t             length;
+
+    /* Records of the oldest payload in flight are finished, or go back
+     * to backlog when radio never got to send them */
+    while ((message = nrfcan_ring_peek(&svc->txq, &cursor, &length)) != 0) {
+        if ((message->flags & NRFCAN_MESSAGE_INFLIGHT) && (message->tag == tag)) {
+            message->flags &= ~NRFCAN_MESSAGE_INFLIGHT;
+            if (done) {
+                message->flags |= NRFCAN_MESSAGE_DONE;
+            }
+        }
+    }
+    svc->txhead = (svc->txhead + 1) % NRFCAN_TX_FIFO_DEPTH;
+    svc->txcount--;
+    nrf24l01_service_reclaim(svc);
+}
+
+static void nrf24l01_service_complete(nrf24l01_service_t *svc) {
+    if (svc->txcount > 0) {
+        /* Payloads leave the radio in order they were written */
+        svc->stats.tx_complete[svc->txslot[svc->txhead]]++;
+#if (NRFCAN_USE_HOPPING == 1)
+        svc->stats.hop_complete[svc->hop_seq[svc->hop_pos]]++;
+        nrf24l01_service_quality(svc, 1);
+#endif
+        nrf24l01_service_settle(svc, 1);
+    }
+}
+
+static void nrf24l01_service_drained(nrf24l01_service_t *svc, uint8_t fifo) {
+    if (!(fifo & NRFCAN_FIFO_TX_EMPTY)) {
+        return;
+    }
+    /* Radio keeps a single TX_DS flag, payloads which left before status
+     * was read are settled once its fifo is empty */
+    while (svc->txcount > 0) {
+        nrf24l01_service_complete(svc);
+    }
+}
+
+static uint32_t nrf24l01_service_random(nrf24l01_service_t *svc) {
+    /* xorshift32 */
+    svc->seed ^= svc->seed << 13;
+    svc->seed ^= svc->seed >> 17;
+    svc->seed ^= svc->seed << 5;
+    return svc->seed;
+}
+
+static uint8_t nrf24l01_service_contend(nrf24l01_service_t *svc, TickType_t now, uint8_t busy) {
+    nrf24l01_message_t *message;
+    uint16_t            cursor = nrfcan_ring_cursor(&svc->txq);
+    uint8_t             length;
+    uint8_t             abandoned = 0;
+
+    while ((message = nrfcan_ring_peek(&svc->txq, &cursor, &length)) != 0) {
+        if ((message->flags & NRFCAN_MESSAGE_TAKEN) || (message->size == 0)) {
+            continue;
+        }
+        if (!(message->flags & NRFCAN_MESSAGE_CONTENDED)) {
+            /* First time this record waits for the channel */
+            message->flags |= NRFCAN_MESSAGE_CONTENDED;
+            message->access = (uint16_t) now;
+        } else if (busy && ((uint16_t) ((uint16_t) now - message->access) >= NRFCAN_ACCESS_DEADLINE)) {
+            /* Channel stayed busy for too long since it first tried */
+            svc->stats.tx_abandoned[message->tclass]++;
+            message->flags |= NRFCAN_MESSAGE_DONE;
+            abandoned++;
+        }
+    }
+    if (abandoned > 0) {
+        nrf24l01_service_reclaim(svc);
+    }
+    return abandoned;
+}
+
+static void nrf24l01_service_accessed(nrf24l01_service_t *svc, const nrf24l01_message_t *message, TickType_t now) {
+    uint16_t delay;
+
+    if (!(message->flags & NRFCAN_MESSAGE_CONTENDED)) {
+        /* Queued while window was open, never waited for the channel */
+        return;
+    }
+    delay = (uint16_t) now - message->access;
+    svc->stats.access_count++;
+    svc->stats.access_delay_total += delay;
+    if (delay > svc->stats.access_delay_max) {
+        svc->stats.access_delay_max = delay;
+    }
+}
+
+static void nrf24l01_service_backoff(nrf24l01_service_t *svc, TickType_t now) {
+    uint32_t window;
+
+    /* Nodes share start up timing, mix in cycle count of the busy sample
+     * so their backoff sequences diverge */
+    svc->seed ^= DWT->CYCCNT;
+    if (svc->seed == 0) {
+        svc->seed = 1;
+    }
+
+    /* Random wait from contention window doubled with every busy sample */
+    if (svc->backoff < NRFCAN_BACKOFF_MAX_EXP) {
+        svc->backoff++;
+    }
+    window = 1u << svc->backoff;
+    svc->retry_at = now + (1 + (nrf24l01_service_random(svc) % window)) * NRFCAN_BACKOFF_SLOT;
+    svc->retry = 1;
+}
+
+static void nrf24l01_service_transmit(nrf24l01_service_t *svc) {
+    nrf24l01_message_t *message;
+    nrf24l01_message_t *head;
+#if (NRFCAN_USE_AGGREGATION == 1)
+    nrf24l01_message_t *next;
+    nrf24l01_message_t  payload;
+    uint16_t            used;
+    uint8_t             length;
+#endif
+    uint16_t            cursor;
+    uint16_t            slack;
+    TickType_t          now;
+
+    if ((svc->mode == NRFCAN_MODE_OFF) || (svc->mode == NRFCAN_MODE_UNKNOWN)) {
+        return;
+    }
+    now = nrf24l01_service_ticks();
+    message = nrf24l01_service_pick(svc, now, &cursor);
+    if (message == 0) {
+        return;
+    }
+#if (NRFCAN_USE_TDMA == 1)
+    if (svc->tdma_synced && ((now - svc->tdma_sync) >= NRFCAN_TDMA_TIMEOUT)) {
+        /* SYNC producer is gone */
+        svc->tdma_synced = 0;
+    }
+#endif
+#if (NRFCAN_USE_SYNC == 1)
+    if (nrf24l01_service_held(svc, message, now)) {
+        return;
+    }
+#endif
+#if (NRFCAN_USE_TDMA == 1)
+    if (svc->tdma_synced && (svc->tdma_slot != 0) && !(message->flags & NRFCAN_MESSAGE_SYNC) &&
+        (svc->mode != NRFCAN_MODE_TRANSMIT)) {
+        /* Held check put us into own slot, which is reserved for this node,
+         * no need to sample the channel */
+        svc->retry = 0;
+        svc->backoff = 0;
+        svc->txwindow = 0;
+    } else
+#endif
+    if (svc->mode != NRFCAN_MODE_TRANSMIT) {
+        if (svc->retry) {
+            if ((int32_t) (now - svc->retry_at) < 0) {
+                /* Still backing off */
+                return;
+            }
+        }
+        svc->retry = 0;
+
+        /* Opening new transmit window, receiver was running since the last
+         * one so channel activity measurement is up to date */
+        svc->commands++;
+        if (!nrf24l01_channel_available(&svc->device)) {
+            /* Channel is not available, postpone transmission */
+            svc->stats.tx_postponed[message->tclass]++;
+#if (NRFCAN_USE_HOPPING == 1)
+            svc->stats.hop_postponed[svc->hop_seq[svc->hop_pos]]++;
+            nrf24l01_service_quality(svc, 0);
+#endif
+            if (nrf24l01_service_contend(svc, now, 1) > 0) {
+                /* Records which waited longest are gone, the rest starts over */
+                svc->backoff = 0;
+                svc->retry = 0;
+                return;
+            }
+            nrf24l01_service_backoff(svc, now);
+            return;
+        }
+
+        /* Channel acquired, records queued by now count as contending */
+        nrf24l01_service_contend(svc, now, 0);
+        svc->backoff = 0;
+        svc->txwindow = 0;
+    }
+
+    /* Keep radio fifo filled as long as there is backlog and window lasts */
+    while ((svc->txcount < NRFCAN_TX_FIFO_DEPTH) && (svc->txwindow < NRFCAN_TX_WINDOW)) {
+        message = nrf24l01_service_pick(svc, now, &cursor);
+        if (message == 0) {
+            break;
+        }
+#if (NRFCAN_USE_SYNC == 1)
+        if (nrf24l01_service_held(svc, message, now)) {
+            break;
+        }
+#endif
+#if (NRFCAN_USE_PIPES == 1)
+        if (!nrf24l01_service_redirect(svc, message)) {
+            break;
+        }
+#endif
+        /* How close to its deadline the frame made it */
+        slack = message->deadline - (uint16_t) now;
+        if (slack < svc->stats.tx_slack_min) {
+            svc->stats.tx_slack_min = slack;
+        }
+#if (NRFCAN_USE_SHAPING == 1)
+        nrf24l01_service_charge(svc, message->shape, NRFCAN_AIR_OVERHEAD + NRFCAN_LINK_HEADER + NRFCAN_LINK_PARITY + message->size);
+#endif
+        head = message;
+#if (NRFCAN_USE_AGGREGATION == 1)
+        used = 1;
+        /* Append following frames as long as they fit into the same payload */
+        payload.size = 0;
+        payload.tclass = message->tclass;
+        payload.flags = message->flags;
+        nrfcan_codec_append(&payload.data[0], &payload.size, NRFCAN_PAYLOAD_LIMIT, &message->data[0], message->size);
+        while ((next = nrfcan_ring_peek(&svc->txq, &cursor, &length)) != 0) {
+            if ((next->flags & NRFCAN_MESSAGE_TAKEN) || (next->size == 0)) {
+                continue;
+            }
+#if (NRFCAN_USE_DEADLINE == 1)
+            if ((int16_t) (next->deadline - (uint16_t) now) < 0) {
+                /* Left for expiry accounting */
+                continue;
+            }
+#endif
+            if (next->tclass != message->tclass) {
+                /* Acknowledged and broadcast frames travel separately */
+                break;
+            }
+#if (NRFCAN_USE_PIPES == 1)
+            if (next->group != message->group) {
+                /* Payload has a single destination address */
+                break;
+            }
+#endif
+#if (NRFCAN_USE_TDMA == 1)
+            if ((next->flags & ~NRFCAN_MESSAGE_SHAPED) != (message->flags & ~NRFCAN_MESSAGE_SHAPED)) {
+                /* SYNC is sent on its own, the rest waits for node slot */
+                break;
+            }
+#endif
+#if (NRFCAN_USE_SHAPING == 1)
+            if (!nrf24l01_service_budget(svc, next)) {
+                continue;
+            }
+#endif
+            if (nrfcan_codec_append(&payload.data[0], &payload.size, NRFCAN_PAYLOAD_LIMIT, &next->data[0], next->size) < 0) {
+                break;
+            }
+#if (NRFCAN_USE_SHAPING == 1)
+            nrf24l01_service_charge(svc, next->shape, next->size);
+#endif
+            svc->stats.tx_aggregated[message->tclass]++;
+            nrf24l01_service_accessed(svc, next, now);
+            next->flags |= NRFCAN_MESSAGE_INFLIGHT;
+            next->tag = svc->txtag;
+            used++;
+        }
+        if (used > 1) {
+            message = &payload;
+        }
+#endif
+        /* Record stays in the ring until radio reports the outcome */
+        nrf24l01_service_accessed(svc, head, now);
+        head->flags |= NRFCAN_MESSAGE_INFLIGHT;
+        head->tag = svc->txtag;
+        nrf24l01_service_write(svc, message);
+#if (NRFCAN_USE_RATE == 1)
+        if ((message->flags & NRFCAN_MESSAGE_RATE) && !svc->rate_switch) {
+            /* First announcement is out, peers switch this long after it */
+            svc->rate_at = now + pdMS_TO_TICKS(NRFCAN_RATE_SWITCH);
+            svc->rate_switch = 1;
+        }
+#endif
+#if (NRFCAN_USE_SYNC == 1)
+        if (message->flags & NRFCAN_MESSAGE_SYNC) {
+            /* This node produces SYNC, its frame starts now */
+            nrf24l01_service_synced(svc, now);
+        }
+#endif
+        svc->txwindow++;
+    }
+}
+
+#if (NRFCAN_USE_TDMA == 1)
+static int nrf24l01_service_slot(nrf24l01_service_t *svc, TickType_t now, TickType_t *next) {
+    TickType_t elapsed = now - svc->tdma_sync;
+    TickType_t begin;
+
+    /* Slots repeat after the last SYNC until the next one arrives */
+    begin = elapsed - (elapsed % (NRFCAN_TDMA_SLOTS * NRFCAN_TDMA_SLOT));
+    begin += svc->tdma_slot * NRFCAN_TDMA_SLOT;
+    if (elapsed < begin) {
+        *next = svc->tdma_sync + begin;
+        return 0;
+    }
+    if (elapsed < (begin + NRFCAN_TDMA_SLOT)) {
+        return 1;
+    }
+    *next = svc->tdma_sync + begin + (NRFCAN_TDMA_SLOTS * NRFCAN_TDMA_SLOT);
+    return 0;
+}
+
+#endif
+
+#if (NRFCAN_USE_HOPPING == 1)
+static uint8_t nrf24l01_service_hop_init(nrf24l01_service_t *svc) {
+    uint8_t i;
+    uint8_t j;
+    uint8_t swap;
+
+    /* Every node shuffles channel list with the same seed, so they all
+     * end up with the same sequence */
+    svc->seed = NRFCAN_HOP_SEED;
+    for (i = 0; i < NRFCAN_HOP_NUM; i++) {
+        svc->hop_seq[i] = i;
+        svc->stats.hop_quality[i] = 0xff;
+    }
+    for (i = NRFCAN_HOP_NUM - 1; i > 0; i--) {
+        j = nrf24l01_service_random(svc) % (i + 1);
+        swap = svc->hop_seq[i];
+        svc->hop_seq[i] = svc->hop_seq[j];
+        svc->hop_seq[j] = swap;
+    }
+    svc->hop_pos = 0;
+    svc->hop_pending = 0;
+    return hop_channels[svc->hop_seq[0]];
+}
+
+static void nrf24l01_service_hop(nrf24l01_service_t *svc) {
+    nrf24l01_config_t config = svc->config;
+    uint8_t           index;
+
+    /* Channel appears once per sequence, so node which missed some SYNCs
+     * catches up as soon as the network comes back to its channel */
+    svc->hop_pending = 0;
+    svc->hop_pos = (svc->hop_pos + 1) % NRFCAN_HOP_NUM;
+    index = svc->hop_seq[svc->hop_pos];
+    if (svc->stats.hop_quality[index] < NRFCAN_HOP_BLACKLIST) {
+        svc->stats.hop_quality[index] += NRFCAN_HOP_RECOVER;
+    }
+
+    config.channel = hop_channels[index];
+    nrf24l01_service_mode(svc, NRFCAN_MODE_STANDBY);
+    nrf24l01_service_configure(svc, &config);
+    nrf24l01_service_mode(svc, NRFCAN_MODE_LISTEN);
+
+    /* Contention on previous channel says nothing about this one */
+    svc->retry = 0;
+    svc->backoff = 0;
+    svc->stats.hops++;
+}
+
+static void nrf24l01_service_quality(nrf24l01_service_t *svc, uint8_t good) {
+    uint8_t *quality = &svc->stats.hop_quality[svc->hop_seq[svc->hop_pos]];
+
+    /* Exponential average with weight of 1/8 */
+    *quality = *quality - (*quality >> 3) + (good ? (0xff >> 3) : 0);
+}
+#endif
+
+#if (NRFCAN_USE_ADAPTIVE_RETR == 1)
+static void nrf24l01_service_observe(nrf24l01_service_t *svc, uint8_t retries, uint8_t lost) {
+    uint32_t attempts = retries + 1;
+    uint32_t failures = retries + lost;
+
+    svc->stats.tx_retries += retries;
+#if (NRFCAN_USE_HOPPING == 1)
+    svc->stats.hop_retries[svc->hop_seq[svc->hop_pos]] += retries;
+#endif
+
+    /* Share of failed attempts, exponential average with weight of 1/8 */
+    svc->per -= svc->per >> 3;
+    svc->per += ((failures * 0xffff) / attempts) >> 3;
+    svc->stats.retr_per = svc->per;
+
+    if (++svc->outcomes >= NRFCAN_RETR_PERIOD) {
+        svc->outcomes = 0;
+        nrf24l01_service_retr(svc);
+    }
+}
+
+static void nrf24l01_service_retr(nrf24l01_service_t *svc) {
+    uint32_t loss = svc->per;
+    uint32_t count;
+    uint32_t delay;
+
+    /* Fewest retries which keep loss of all attempts under target */
+    for (count = 0; count < NRFCAN_RETR_COUNT_MIN; count++) {
+        loss = (loss * svc->per) >> 16;
+    }
+    while ((loss > NRFCAN_RETR_TARGET) && (count < NRFCAN_RETR_COUNT_MAX)) {
+        loss = (loss * svc->per) >> 16;
+        count++;
+    }
+
+    /* Noisy channel tends to stay noisy for a while, spread retries out */
+    delay = NRFCAN_RETR_DELAY_MIN + (((NRFCAN_RETR_DELAY_MAX - NRFCAN_RETR_DELAY_MIN) * svc->per) >> 16);
+    delay -= delay % 250;
+#if (NRFCAN_USE_RATE == 1)
+    if ((svc->rate == NRFCAN_RATE_250K) && (delay < 500)) {
+        /* Acknowledgment takes longer at 250 kbps */
+        delay = 500;
+    }
+#endif
+
+    svc->stats.retr_decisions++;
+    if ((count != svc->stats.retr_count) || (delay != svc->stats.retr_delay)) {
+        /* Written once radio is back in receiver */
+        svc->stats.retr_count = count;
+        svc->stats.retr_delay = delay;
+        svc->stats.retr_changes++;
+        svc->retr_pending = 1;
+    }
+#if (NRFCAN_USE_RATE == 1)
+    nrf24l01_service_rate(svc);
+#endif
+}
+#endif
+
+#if (NRFCAN_USE_RATE == 1)
+static void nrf24l01_service_rate(nrf24l01_service_t *svc) {
+    if (!svc->rate_master || (svc->rate_next != svc->rate)) {
+        /* Only SYNC producer decides, one switch at a time */
+        return;
+    }
+    if (svc->per > NRFCAN_RATE_DOWN) {
+        svc->rate_clean = 0;
+        if (svc->rate > NRFCAN_RATE_250K) {
+            nrf24l01_service_rate_propose(svc, svc->rate - 1);
+        }
+        return;
+    }
+    if (svc->per >= NRFCAN_RATE_UP) {
+        svc->rate_clean = 0;
+        return;
+    }
+    /* Step up only after the link stayed clean for a while */
+    if (svc->rate_clean < NRFCAN_RATE_UP_PERIODS) {
+        svc->rate_clean++;
+    }
+    if ((svc->rate_clean >= NRFCAN_RATE_UP_PERIODS) && (svc->rate < NRFCAN_RATE_2M)) {
+        svc->rate_clean = 0;
+        nrf24l01_service_rate_propose(svc, svc->rate + 1);
+    }
+}
+
+static void nrf24l01_service_rate_propose(nrf24l01_service_t *svc, uint8_t rate) {
+    nrf24l01_message_t *message;
+    uint8_t             sent = 0;
+
+    svc->rate_seq++;
+    for (uint8_t i = 0; i < NRFCAN_RATE_REPEAT; i++) {
+        message = nrf24l01_service_alloc(svc);
+        if (message == 0) {
+            break;
+        }
+        message->size = nrfcan_codec_rate(svc->rate_seq, rate, NRFCAN_RATE_SWITCH, &message->data[0], sizeof(message->data));
+        message->tclass = NRFCAN_CLASS_BROADCAST;
+        message->flags |= NRFCAN_MESSAGE_RATE;
+        nrf24l01_service_send(svc, message);
+        sent++;
+    }
+    if (sent > 0) {
+        /* Switch is scheduled once the first announcement leaves the radio */
+        svc->rate_next = rate;
+    }
+}
+
+static void nrf24l01_service_rate_switch(nrf24l01_service_t *svc, TickType_t now) {
+    if (svc->rate_next > svc->rate) {
+        svc->stats.rate_ups++;
+    } else if (svc->rate_next < svc->rate) {
+        svc->stats.rate_downs++;
+    }
+    svc->rate = svc->rate_next;
+    svc->rate_switch = 0;
+
+    nrf24l01_service_mode(svc, NRFCAN_MODE_STANDBY);
+    nrf24l01_data_rate(&svc->device, rates_kbps[svc->rate]);
+    svc->commands++;
+    nrf24l01_service_mode(svc, NRFCAN_MODE_LISTEN);
+    svc->stats.rate_kbps = rates_kbps[svc->rate];
+
+    /* Error rate measured at previous rate does not apply anymore */
+    svc->per = 0;
+    svc->outcomes = 0;
+    svc->rate_clean = 0;
+    svc->rate_heard = now;
+}
+
+static void nrf24l01_service_on_rate(nrf24l01_service_t *svc, const nrf24l01_payload_t *message) {
+    uint8_t  seq;
+    uint8_t  rate;
+    uint16_t delay;
+
+    if (nrfcan_codec_on_rate(&message->data[0], message->size, &seq, &rate, &delay) <= 0) {
+        return;
+    }
+    if (svc->rate_master || (rate >= NRFCAN_RATE_NUM) || ((seq == svc->rate_seq) && (rate == svc->rate_next))) {
+        /* Repeated announcement of already scheduled switch */
+        return;
+    }
+    svc->rate_seq = seq;
+    svc->rate_next = rate;
+    svc->rate_at = nrf24l01_service_ticks() + pdMS_TO_TICKS(delay);
+    svc->rate_switch = 1;
+}
+#endif
+
+#if (NRFCAN_USE_SYNC == 1)
+static int nrf24l01_service_held(nrf24l01_service_t *svc, const nrf24l01_message_t *message, TickType_t now) {
+    if (message->flags & NRFCAN_MESSAGE_SYNC) {
+        /* SYNC is never held, it keeps the network together */
+        return 0;
+    }
+#if (NRFCAN_USE_HOPPING == 1)
+    if (svc->stats.hop_quality[svc->hop_seq[svc->hop_pos]] < NRFCAN_HOP_BLACKLIST) {
+        /* Channel is blacklisted, backlog waits for the next hop */
+        if (svc->mode != NRFCAN_MODE_TRANSMIT) {
+            svc->stats.hop_deferred++;
+        }
+        svc->retry_at = now + NRFCAN_HOP_HOLD;
+        svc->retry = 1;
+        return 1;
+    }
+#endif
+#if (NRFCAN_USE_TDMA == 1)
+    if (!svc->tdma_synced || (svc->tdma_slot == 0)) {
+        return 0;
+    }
+    if (nrf24l01_service_slot(svc, now, &svc->retry_at)) {
+        return 0;
+    }
+    if (svc->mode != NRFCAN_MODE_TRANSMIT) {
+        svc->stats.tdma_deferred++;
+    }
+    /* Wake up when own slot begins */
+    svc->retry = 1;
+    return 1;
+#else
+    (void) now;
+    return 0;
+#endif
+}
+
+static void nrf24l01_service_synced(nrf24l01_service_t *svc, TickType_t now) {
+#if (NRFCAN_USE_TDMA == 1)
+    /* Frame starts with SYNC */
+    svc->tdma_sync = now;
+    svc->tdma_synced = 1;
+    svc->stats.tdma_syncs++;
+#else
+    (void) now;
+#endif
+#if (NRFCAN_USE_HOPPING == 1)
+    /* Hop once radio is done with the current channel */
+    svc->hop_pending = 1;
+#endif
+}
+
+static void nrf24l01_service_on_sync(nrf24l01_service_t *svc, const nrf24l01_payload_t *message) {
+    nrfcan_frame_t frame;
+    uint8_t        pos = 0;
+
+    if (nrfcan_codec_is_control(&message->data[0], message->size)) {
+        return;
+    }
+    while (nrfcan_codec_decode(&svc->codec, &message->data[0], message->size, &pos, message->source, &frame) >= 0) {
+        if (frame.identifier == NRFCAN_TDMA_SYNC_ID) {
+            nrf24l01_service_synced(svc, nrf24l01_service_ticks());
+            return;
+        }
+    }
+}
+#endif
+
+void co_can_nrf24l01_tdma_slot(uint8_t node_id) {
+    /* Slot 0 is left to SYNC producer */
+    service.tdma_slot = (node_id == 0) ? 0 : (1 + ((node_id - 1) % (NRFCAN_TDMA_SLOTS - 1)));
+}
+
+int co_can_nrf24l01_mailbox_add(uint32_t identifier) {
+#if (NRFCAN_USE_MAILBOX == 1)
+    nrfcan_mailbox_t *mailbox;
+
+    if (nrf24l01_service_mailbox_find(&service, identifier) >= 0) {
+        return (0);
+    }
+    if (service.mailbox_count >= NRFCAN_MAILBOX_NUM) {
+        return (-1);
+    }
+    /* Must be called before CAN task starts reading */
+    mailbox = &service.mailboxes[service.mailbox_count];
+    mailbox->identifier = identifier;
+    mailbox->version = 0;
+    mailbox->pending = 0;
+    service.mailbox_count++;
+    return (0);
+#else
+    (void) identifier;
+    return (-1);
+#endif
+}
+
+int co_can_nrf24l01_accept_add(uint32_t identifier) {
+#if (NRFCAN_USE_ACCEPT == 1)
+    uint8_t slot;
+
+    /* Must be called before the driver is enabled */
+    service.accept_active = 1;
+    if (identifier <= 0x7ff) {
+        service.accept_std[identifier >> 5] |= (1u << (identifier & 0x1f));
+        return (0);
+    }
+    slot = nrf24l01_service_ext_slot(identifier);
+    for (uint8_t i = 0; i < NRFCAN_ACCEPT_EXT_NUM; i++) {
+        if ((service.accept_ext[slot] == identifier) || (service.accept_ext[slot] == 0)) {
+            service.accept_ext[slot] = identifier;
+            return (0);
+        }
+        slot = (slot + 1) & (NRFCAN_ACCEPT_EXT_NUM - 1);
+    }
+    /* Out of room, better let every extended frame through than lose one */
+    service.accept_ext_all = 1;
+    return (-1);
+#else
+    (void) identifier;
+    return (-1);
+#endif
+}
+
+int co_can_nrf24l01_deadline_add(uint32_t first, uint32_t last, uint32_t lifetime_ms) {
+    TickType_t lifetime = pdMS_TO_TICKS(lifetime_ms);
+
+    if ((first > last) || (last > 0x7ff)) {
+        return (-1);
+    }
+    /* Deadline is compared as signed 16 bit tick difference */
+    if (lifetime == 0) {
+        lifetime = 1;
+    } else if (lifetime > INT16_MAX) {
+        lifetime = INT16_MAX;
+    }
+    /* Must be called before the driver is enabled */
+    for (uint8_t i = 0; i < service.deadline_count; i++) {
+        if ((service.deadline_ranges[i].first == first) && (service.deadline_ranges[i].last == last)) {
+            service.deadline_ranges[i].lifetime = lifetime;
+            return (0);
+        }
+    }
+    if (service.deadline_count >= NRFCAN_DEADLINE_NUM) {
+        return (-1);
+    }
+    service.deadline_ranges[service.deadline_count].first = first;
+    service.deadline_ranges[service.deadline_count].last = last;
+    service.deadline_ranges[service.deadline_count].lifetime = lifetime;
+    service.deadline_count++;
+    return (0);
+}
+
+int co_can_nrf24l01_pipe_add(uint32_t identifier) {
+#if (NRFCAN_USE_PIPES == 1)
+    uint8_t group = nrf24l01_service_group(identifier);
+
+    if ((group == NRFCAN_GROUP_BROADCAST) || (group == service.node_id)) {
+        /* Always listened to */
+        return (0);
+    }
+    for (uint8_t i = 0; i < service.pipe_count; i++) {
+        if (service.pipe_groups[i] == group) {
+            return (0);
+        }
+    }
+    if (service.pipe_count >= (NRFCAN_PIPE_NUM - NRFCAN_PIPE_FIRST_GROUP)) {
+        return (-1);
+    }
+    /* Must be called after node id is set and before the driver is enabled */
+    service.pipe_groups[service.pipe_count] = group;
+    service.pipe_count++;
+    return (0);
+#else
+    (void) identifier;
+    return (-1);
+#endif
+}
+
+void co_can_nrf24l01_node_id(uint8_t node_id) {
+    /* Identifies this node in link header of every payload */
+    service.node_id = node_id;
+#if (NRFCAN_USE_SEQUENCE == 1)
+    /* Receivers learn the sender from link header, node relative
+     * dictionary entries can be used */
+    nrfcan_codec_node(&service.codec, node_id);
+#endif
+}
+
+int co_can_nrf24l01_dict_add(uint32_t identifier) {
+    return nrfcan_codec_dict_add(&service.codec, identifier);
+}
+
+static void nrf24l01_service_on_control(nrf24l01_service_t *svc, nrf24l01_payload_t *message) {
+    nrf24l01_message_t *reply;
+
+    if (nrfcan_codec_on_control(&svc->codec, &message->data[0], message->size) > 0) {
+        reply = nrf24l01_service_alloc(svc);
+        if (reply != 0) {
+            reply->size = nrfcan_codec_hello(&svc->codec, NRFCAN_CODEC_HELLO_REPLY, &reply->data[0], sizeof(reply->data));
+            reply->tclass = NRFCAN_CLASS_ACKED;
+            nrf24l01_service_send(svc, reply);
+        }
+    }
+}
+
+static void nrf24l01_service_kick(nrf24l01_service_t *svc) {
+#if (NRFCAN_USE_SERVICE_TASK == 1)
+    xTaskNotifyGive(svc->task);
+#else
+    nrf24l01_trigger_irq(&svc->device);
+#endif
+}
+
+static void nrf24l01_service_on_irq(void *context) {
+    BaseType_t          xHigherPriorityTaskWoken = pdFALSE;
+    nrf24l01_service_t *svc = (nrf24l01_service_t*) (context);
+    uint32_t            start = DWT->CYCCNT;
+    uint32_t            cycles;
+
+#if (NRFCAN_USE_SERVICE_TASK == 1)
+    /* Only wake service task, radio is accessed outside of interrupt */
+    svc->irqstamp = start;
+    svc->irqpending = 1;
+    vTaskNotifyGiveFromISR(svc->task, &xHigherPriorityTaskWoken);
+#else
+    nrf24l01_service_on_event(svc, &xHigherPriorityTaskWoken);
+#endif
+
+    cycles = DWT->CYCCNT - start;
+    if (cycles > svc->stats.irq_cycles_max) {
+        svc->stats.irq_cycles_max = cycles;
+    }
+
+    portYIELD_FROM_ISR(xHigherPriorityTaskWoken);
+}
+
+#if (NRFCAN_USE_SERVICE_TASK == 1)
+static TickType_t nrf24l01_service_timeout(nrf24l01_service_t *svc) {
+    TickType_t now = xTaskGetTickCount();
+    TickType_t timeout = portMAX_DELAY;
+    TickType_t at;
+
+    if (nrfcan_ring_frames(&svc->txq) > 0) {
+        if (!svc->retry) {
+            /* Leftover backlog is retried once receiver had time to sample the channel */
+            timeout = NRFCAN_BACKOFF_SLOT;
+        } else {
+            timeout = ((int32_t) (svc->retry_at - now) > 0) ? (svc->retry_at - now) : 0;
+        }
+    }
+#if (NRFCAN_USE_RATE == 1)
+    /* Wake up for scheduled rate switch or when peers go quiet */
+    if (svc->rate_switch || !svc->rate_master) {
+        at = svc->rate_switch ? svc->rate_at : (svc->rate_heard + NRFCAN_RATE_TIMEOUT);
+        at = ((int32_t) (at - now) > 0) ? (at - now) : NRFCAN_BACKOFF_SLOT;
+        if (at < timeout) {
+            timeout = at;
+        }
+    }
+#endif
+    /* Health check runs even when nothing else happens */
+    at = ((int32_t) (svc->health_at + NRFCAN_HEALTH_PERIOD - now) > 0) ? (svc->health_at + NRFCAN_HEALTH_PERIOD - now) : 0;
+    if (at < timeout) {
+        timeout = at;
+    }
+    return timeout;
+}
+
+static void nrf24l01_service_task(void *context) {
+    nrf24l01_service_t *svc = (nrf24l01_service_t*) (context);
+    uint32_t            start;
+    uint32_t            cycles;
+
+    while (1) {
+        /* Sleep until radio interrupt, new message or end of backoff */
+        ulTaskNotifyTake(pdTRUE, nrf24l01_service_timeout(svc));
+
+        start = DWT->CYCCNT;
+        if (svc->irqpending) {
+            /* Time from radio interrupt until its service begins */
+            svc->irqpending = 0;
+            cycles = start - svc->irqstamp;
+            if (cycles > svc->stats.wake_cycles_max) {
+                svc->stats.wake_cycles_max = cycles;
+            }
+        }
+
+        nrf24l01_service_on_event(svc, 0);
+
+        cycles = DWT->CYCCNT - start;
+        if (cycles > svc->stats.event_cycles_max) {
+            svc->stats.event_cycles_max = cycles;
+        }
+    }
+}
+#endif
+
+static void nrf24l01_service_on_event(nrf24l01_service_t *svc, BaseType_t *woken) {
+    nrf24l01_payload_t *message;
+    nrf24l01_payload_t  discard;
+#if (NRFCAN_USE_ADAPTIVE_RETR == 1)
+    nrf24l01_config_t   config;
+    uint8_t             retries = 0;
+#endif
+    uint8_t             received = 0;
+    uint8_t             pending;
+    uint8_t             status;
+    uint8_t             fifo = 0;
+    uint8_t             fifo_read = 0;
+    TickType_t          now;
+
+    svc->commands = 0;
+
+    if (svc->mode_request != 0) {
+        nrf24l01_service_on_request(svc);
+    }
+
+    /* Read and clear status register, radio is left in its current mode */
+    status = nrf24l01_clear_status(&svc->device);
+    svc->commands++;
+
+    /* Status already tells whether receive fifo holds a payload, fifo status
+     * is read only to find out whether more of them follow */
+    pending = ((status & NRFCAN_STATUS_RX_P_NO) != NRFCAN_STATUS_RX_P_NO);
+    if (pending) {
+        /* Read all pending messages */
+        while (pending) {
+            message = nrfcan_ring_reserve(&svc->rxq, sizeof(nrf24l01_payload_t));
+            if (message != 0) {
+                /* Fetch message from device straight into the ring */
+                nrf24l01_read(&svc->device, &message->data[0], &message->size);
+                if (nrf24l01_service_accept(svc, message) > 0) {
+                    nrfcan_ring_commit(&svc->rxq, NRFCAN_PAYLOAD_LENGTH(message));
+                    /* Reception complete */
+                    svc->stats.rx_complete++;
+                    received++;
+                }
+                /* Otherwise slot is left uncommitted and reused by next payload */
+            } else {
+                /* Ring is full, message is lost */
+                nrf24l01_read(&svc->device, &discard.data[0], &discard.size);
+#if (NRFCAN_USE_MAILBOX == 1)
+                /* Process data in it still reaches its mailbox */
+                nrf24l01_service_accept(svc, &discard);
+#endif
+                svc->stats.rx_lost++;
+            }
+            /* Same read tells about transmit fifo later on */
+            fifo = nrf24l01_read_register(&svc->device, NRFCAN_REG_FIFO_STATUS);
+            fifo_read = 1;
+            pending = !(fifo & NRFCAN_FIFO_RX_EMPTY);
+            svc->commands += 2;
+        }
+#if (NRFCAN_USE_MAILBOX == 1)
+        if (svc->mailbox_fresh) {
+            svc->mailbox_fresh = 0;
+            received++;
+        }
+#endif
+        if ((received > 0) && (svc->rxtask != 0)) {
+            if (woken != 0) {
+                vTaskNotifyGiveFromISR(svc->rxtask, woken);
+            } else {
+                xTaskNotifyGive(svc->rxtask);
+            }
+        }
+    }
+    if (status & NRF24L01_STATUS_TX_DS) {
+#if (NRFCAN_USE_ADAPTIVE_RETR == 1)
+        /* Payload sent without acknowledgment tells nothing about the link */
+        if ((svc->txcount > 0) && ((NRFCAN_USE_NOACK == 0) || (svc->txslot[svc->txhead] != NRFCAN_CLASS_BROADCAST))) {
+#if (NRFCAN_USE_OBSERVE == 1)
+            /* Retransmissions needed by the last delivered payload */
+            retries = nrf24l01_observe_tx(&svc->device) & 0x0f;
+            svc->commands++;
+#endif
+            nrf24l01_service_observe(svc, retries, 0);
+        }
+#endif
+        /* Oldest transmission complete, without ACK this only means it was sent */
+        nrf24l01_service_complete(svc);
+    }
+    if (status & NRF24L01_STATUS_MAX_RT) {
+#if (NRFCAN_USE_ADAPTIVE_RETR == 1)
+        /* Every attempt of the head payload failed */
+        nrf24l01_service_observe(svc, svc->config.retr_count, 1);
+#endif
+        /* Flush devices tx fifo in order to release failed transmission,
+         * payloads behind it were never tried and go back to backlog */
+        nrf24l01_flush_tx(&svc->device);
+        svc->commands++;
+        if (svc->txcount > 0) {
+            svc->stats.tx_lost[svc->txslot[svc->txhead]]++;
+#if (NRFCAN_USE_HOPPING == 1)
+            svc->stats.hop_lost[svc->hop_seq[svc->hop_pos]]++;
+            nrf24l01_service_quality(svc, 0);
+#endif
+            nrf24l01_service_settle(svc, 1);
+        }
+        while (svc->txcount > 0) {
+            nrf24l01_service_settle(svc, 0);
+        }
+        /* Channel is apparently busy, close the window and listen again */
+        svc->txwindow = NRFCAN_TX_WINDOW;
+    }
+    if (!(status & NRFCAN_STATUS_TX_FULL) && (svc->txcount >= NRFCAN_TX_FIFO_DEPTH)) {
+        /* Completions were merged into single interrupt, fifo has room again */
+        nrf24l01_service_complete(svc);
+    }
+    if ((svc->mode == NRFCAN_MODE_TRANSMIT) && (svc->txcount > 0)) {
+        /* Empty radio fifo ends the window whatever the count says, fifo
+         * status is read once per event */
+        if (!fifo_read) {
+            fifo = nrf24l01_read_register(&svc->device, NRFCAN_REG_FIFO_STATUS);
+            svc->commands++;
+        }
+        nrf24l01_service_drained(svc, fifo);
+    }
+
+    nrf24l01_service_transmit(svc);
+    if ((svc->mode == NRFCAN_MODE_TRANSMIT) && (svc->txcount == 0)) {
+        /* Transmit window is over, return to receiver */
+        nrf24l01_service_mode(svc, NRFCAN_MODE_LISTEN);
+    }
+
+#if (NRFCAN_USE_ADAPTIVE_RETR == 1)
+    if (svc->retr_pending && (svc->mode == NRFCAN_MODE_LISTEN)) {
+        /* Nothing in flight, apply new retransmit setting */
+        config = svc->config;
+        config.retr_count = svc->stats.retr_count;
+        config.retr_delay = svc->stats.retr_delay;
+        nrf24l01_service_configure(svc, &config);
+        svc->retr_pending = 0;
+    }
+#endif
+
+#if (NRFCAN_USE_HOPPING == 1)
+    if (svc->hop_pending && (svc->mode == NRFCAN_MODE_LISTEN)) {
+        /* Nothing in flight, follow SYNC to the next channel */
+        nrf24l01_service_hop(svc);
+    }
+#endif
+
+    now = nrf24l01_service_ticks();
+#if (NRFCAN_USE_RATE == 1)
+    if (!svc->rate_master && !svc->rate_switch && ((now - svc->rate_heard) >= NRFCAN_RATE_TIMEOUT)) {
+        /* Peers went quiet, they may have switched without us */
+        svc->rate_next = (svc->rate + NRFCAN_RATE_NUM - 1) % NRFCAN_RATE_NUM;
+        svc->rate_at = now;
+        svc->rate_switch = 1;
+        svc->stats.rate_scans++;
+    }
+    if (svc->rate_switch && ((int32_t) (now - svc->rate_at) >= 0) && (svc->mode == NRFCAN_MODE_LISTEN)) {
+        nrf24l01_service_rate_switch(svc, now);
+    }
+#endif
+    if ((now - svc->health_at) >= NRFCAN_HEALTH_PERIOD) {
+        svc->health_at = now;
+        nrf24l01_service_health(svc);
+    }
+    if ((now - svc->settle_start) >= configTICK_RATE_HZ) {
+        /* Settling time spent during last second */
+        svc->stats.settle_us_per_s = (uint32_t) (((uint64_t) svc->settle_us * configTICK_RATE_HZ) / (now - svc->settle_start));
+        svc->settle_us = 0;
+        svc->settle_start = now;
+    }
+
+    svc->stats.events++;
+    svc->stats.commands += svc->commands;
+    if (svc->commands > svc->stats.commands_max) {
+        svc->stats.commands_max = svc->commands;
+    }
 }
@@ -47,6 +47,14 @@ static void co_timer_task_handler(void *context);
 
 static void co_can_task_handler(void *context);
 
+static void co_mailbox_build(void);
+
+static void co_accept_build(void);
+
+static void co_deadline_build(void);
+
+static CO_OBJ* co_od_find(uint16_t idx, uint8_t sub);
+
 
 static CO_TMR_MEM CoTimerMemory[CO_NODE_TMR_N];
 
@@ -58,6 +66,19 @@ static struct CO_IF_DRV_T CoDriver = {
     &DummyNvmDriver,
 };
 
+/* Identifiers sent as one byte dictionary index, every node of the network
+ * must list the same ones. Node relative entries stand for the object of
+ * whichever node sent the frame, so cyclic traffic of all nodes fits */
+static const uint32_t CoCobIdDictionary[] = {
+    0x000,                              /* NMT                */
+    0x080,                              /* SYNC               */
+    NRFCAN_CODEC_DICT_NODE | 0x700,     /* Heartbeat          */
+    NRFCAN_CODEC_DICT_NODE | 0x180,     /* TPDO1              */
+    NRFCAN_CODEC_DICT_NODE | 0x280,     /* TPDO2              */
+    NRFCAN_CODEC_DICT_NODE | 0x580,     /* SDO response       */
+};
+
+
 static CO_EMCY_TBL CoEmcyTable[CO_ERR_ID_NUM] = {
     { CO_EMCY_REG_GENERAL, CO_EMCY_CODE_GEN_ERR          }, /* CO_ERR_ID_SOMETHING */
     { CO_EMCY_REG_TEMP   , CO_EMCY_CODE_TEMP_AMBIENT_ERR }  /* CO_ERR_ID_HOT   */
@@ -124,6 +145,15 @@ CO_NODE* co_node_initialize(void) {
 
     CONodeInit(&co_node_nrf24l01, &co_node_nrf24l01_spec);
 
+    for (uint8_t i = 0; i < (sizeof(CoCobIdDictionary) / sizeof(CoCobIdDictionary[0])); i++) {
+        co_can_nrf24l01_dict_add(CoCobIdDictionary[i]);
+    }
+    co_can_nrf24l01_tdma_slot(CO_NODE_ID);
+    co_can_nrf24l01_node_id(CO_NODE_ID);
+    co_mailbox_build();
+    co_accept_build();
+    co_deadline_build();
+
     xTaskCreateStatic(&co_timer_task_handler,
                       "CO_TMR",
                       configMINIMAL_STACK_SIZE,
@@ -146,6 +176,156 @@ CO_NODE* co_node_initialize(void) {
 }
 
 
+/* Configured receive PDOs carry cyclic process data, only the newest
+ * value matters */
+static void co_mailbox_build(void) {
+    CO_OBJ     *obj;
+    uint16_t    idx;
+    uint32_t    cobid;
+
+    for (uint16_t i = 0; (i < CO_OD_SIZE) && (co_od_nrf24l01[i].Key != 0); i++) {
+        obj = &co_od_nrf24l01[i];
+        idx = CO_GET_IDX(obj->Key);
+        if ((idx < 0x1400) || (idx > 0x15ff) || (CO_GET_SUB(obj->Key) != 1) || !CO_IS_DIRECT(obj->Key)) {
+            continue;
+        }
+        cobid = (uint32_t) obj->Data;
+        if (CO_IS_NODEID(obj->Key)) {
+            cobid += CO_NODE_ID;
+        }
+        if (cobid & (1u << 31)) {
+            /* PDO is disabled */
+            continue;
+        }
+        cobid &= (cobid & (1u << 29)) ? 0x1fffffff : 0x7ff;
+        co_can_nrf24l01_mailbox_add(cobid);
+        co_can_nrf24l01_pipe_add(cobid);
+    }
+}
+
+/* Let the driver drop received frames no object of this node consumes */
+static void co_accept_build(void) {
+    CO_OBJ     *obj;
+    uint16_t    idx;
+    uint8_t     sub;
+    uint32_t    cobid;
+
+    /* NMT reaches every node */
+    co_can_nrf24l01_accept_add(0x000);
+
+    for (uint16_t i = 0; (i < CO_OD_SIZE) && (co_od_nrf24l01[i].Key != 0); i++) {
+        obj = &co_od_nrf24l01[i];
+        idx = CO_GET_IDX(obj->Key);
+        sub = CO_GET_SUB(obj->Key);
+
+        if ((idx == 0x1016) && (sub > 0) && (obj->Type == CO_THB_CONS)) {
+            /* Heartbeat of monitored node */
+            co_can_nrf24l01_accept_add(0x700 + ((CO_HBCONS*) obj->Data)->NodeId);
+            continue;
+        }
+        if (!CO_IS_DIRECT(obj->Key)) {
+            continue;
+        }
+        cobid = (uint32_t) obj->Data;
+        if (CO_IS_NODEID(obj->Key)) {
+            cobid += CO_NODE_ID;
+        }
+
+        if (idx == 0x1005) {
+            /* SYNC consumer unless this node generates it */
+            if (cobid & (1u << 30)) {
+                continue;
+            }
+        } else if (idx == 0x1012) {
+            /* TIME consumer */
+            if (!(cobid & (1u << 31))) {
+                continue;
+            }
+        } else if ((idx == 0x1028) && (sub > 0)) {
+            /* Emergency consumer */
+        } else if ((idx >= 0x1200) && (idx <= 0x127f) && (sub == 1)) {
+            /* SDO server request */
+        } else if ((idx >= 0x1280) && (idx <= 0x12ff) && (sub == 2)) {
+            /* SDO client response */
+        } else if ((idx >= 0x1400) && (idx <= 0x15ff) && (sub == 1)) {
+            /* Receive PDO */
+        } else {
+            continue;
+        }
+        if ((idx != 0x1012) && (cobid & (1u << 31))) {
+            /* Object is disabled, TIME uses this bit for consumer instead */
+            continue;
+        }
+        co_can_nrf24l01_accept_add(cobid & ((cobid & (1u << 29)) ? 0x1fffffff : 0x7ff));
+    }
+}
+
+/* Frame produced periodically is worth sending only until the next one,
+ * periods come from SYNC cycle, TPDO event timers and heartbeat producer */
+static void co_deadline_build(void) {
+    CO_OBJ     *obj;
+    CO_OBJ     *cob;
+    uint16_t    idx;
+    uint8_t     sub;
+    uint32_t    cobid;
+    uint32_t    period;
+
+    for (uint16_t i = 0; (i < CO_OD_SIZE) && (co_od_nrf24l01[i].Key != 0); i++) {
+        obj = &co_od_nrf24l01[i];
+        idx = CO_GET_IDX(obj->Key);
+        sub = CO_GET_SUB(obj->Key);
+        if (!CO_IS_DIRECT(obj->Key)) {
+            continue;
+        }
+        period = (uint32_t) obj->Data;
+        if (period == 0) {
+            /* Object is not produced periodically */
+            continue;
+        }
+
+        if ((idx == 0x1006) && (sub == 0)) {
+            /* Communication cycle period in microseconds */
+            cob = co_od_find(0x1005, 0);
+            cobid = ((cob != 0) && CO_IS_DIRECT(cob->Key)) ? (uint32_t) cob->Data : 0x080;
+            period = (period + 999) / 1000;
+        } else if ((idx == 0x1017) && (sub == 0)) {
+            /* Producer heartbeat time in milliseconds */
+            cobid = 0x700 + CO_NODE_ID;
+        } else if ((idx >= 0x1800) && (idx <= 0x19ff) && (sub == 5)) {
+            /* Transmit PDO event timer in milliseconds */
+            cob = co_od_find(idx, 1);
+            if ((cob == 0) || !CO_IS_DIRECT(cob->Key)) {
+                continue;
+            }
+            cobid = (uint32_t) cob->Data;
+            if (CO_IS_NODEID(cob->Key)) {
+                cobid += CO_NODE_ID;
+            }
+            if (cobid & (1u << 31)) {
+                /* PDO is disabled */
+                continue;
+            }
+        } else {
+            continue;
+        }
+        if (cobid & (1u << 29)) {
+            /* Deadlines cover base identifiers only */
+            continue;
+        }
+        cobid &= 0x7ff;
+        co_can_nrf24l01_deadline_add(cobid, cobid, period);
+    }
+}
+
+static CO_OBJ* co_od_find(uint16_t idx, uint8_t sub) {
+    for (uint16_t i = 0; (i < CO_OD_SIZE) && (co_od_nrf24l01[i].Key != 0); i++) {
+        if ((CO_GET_IDX(co_od_nrf24l01[i].Key) == idx) && (CO_GET_SUB(co_od_nrf24l01[i].Key) == sub)) {
+            return &co_od_nrf24l01[i];
+        }
+    }
+    return (0);
+}
+
 static void co_timer_task_handler(void *context) {
     CO_NODE    *node = (CO_NODE*) context;
     int16_t     num;
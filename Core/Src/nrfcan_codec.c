@@ -0,0 +1,412 @@
+/**
+ ******************************************************************************
+ * @file        nrfcan_codec.c
+ * @author      Zoltan Dolensky
+ * @brief       
+ *
+ ******************************************************************************
+ * @attention
+ *
+ * MIT License
+ * -----------
+ * Copyright (c) 2022 Technical university of Liberec (https://tul.cz)
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ ******************************************************************************
+ */
+
+/*
+ * V1 frame      [EXT|DLC] [identifier, 2 or 4 bytes big-endian] [data]
+ *
+ * V2 frame      first byte never matches start of V1 frame or control payload
+ *   0ddddiii iiiiiiii      11-bit identifier, dddd is length + 2
+ *   1xxxdddd               dictionary entry x (1 - 6)
+ *   1111dddd [4 bytes]     29-bit identifier
+ *
+ * Link          [011sssss] [ssqqqqqq] in front of V2 and control payloads
+ *                          source node s, sequence number q
+ *
+ * Control       [0xff] [type] ...
+ *   0x01/0x02              hello [version] [entry count] [entries, 2 bytes each]
+ *   0x03                   rate  [sequence] [rate] [delay in ms, 2 bytes]
+ *
+ * Payload version and link header are recognized from the first byte, so
+ * every format can be received at any time. Negotiation only decides what
+ * is transmitted. V1 payloads never carry link header, nodes which know
+ * nothing about it keep reading them.
+ *
+ * Dictionary entry is either an identifier or a function code marked with
+ * NRFCAN_CODEC_DICT_NODE, which stands for that object of whichever node
+ * sent the frame. Every node announces its entries in the hello, index is
+ * used only while no peer listed a different entry at the same position.
+ */
+
+#include <string.h>
+
+#include "nrfcan_codec.h"
+
+#define NRFCAN_DLC_EXT_ID           (1 << 7)
+
+/* Bits which are clear in the first byte of every V1 frame */
+#define NRFCAN_V2_MASK              (0x70)
+#define NRFCAN_V2_DLC_OFFSET        (2u)
+#define NRFCAN_V2_DICT              (1 << 7)
+#define NRFCAN_V2_EXT_ID            (0xf0)
+#define NRFCAN_CONTROL              (0xff)
+#define NRFCAN_LINK                 (0x60)
+#define NRFCAN_LINK_MASK            (0xe0)
+
+#define NRFCAN_HELLO_HEADER         (4u)
+
+static int      nrfcan_codec_dict_find(const nrfcan_codec_t *codec, uint32_t identifier);
+
+static int      nrfcan_codec_dict_entry(const nrfcan_codec_t *codec, uint8_t entry, uint8_t source, uint32_t *identifier);
+
+
+void nrfcan_codec_init(nrfcan_codec_t *codec, uint8_t version_max) {
+    memset(codec, 0, sizeof(nrfcan_codec_t));
+    /* Stay on V1 until peer announces support of newer format */
+    codec->version = NRFCAN_CODEC_V1;
+    codec->version_max = version_max;
+}
+
+int nrfcan_codec_dict_add(nrfcan_codec_t *codec, uint32_t identifier) {
+    if ((codec->dict_size >= NRFCAN_CODEC_DICT_SIZE) || ((identifier & ~NRFCAN_CODEC_DICT_NODE) > 0x7ff)) {
+        return (-1);
+    }
+    for (uint8_t i = 0; i < codec->dict_size; i++) {
+        if (codec->dict[i] == identifier) {
+            return (0);
+        }
+    }
+    /* Usable until a peer announces something else at this position */
+    codec->dict_mask |= (1u << codec->dict_size);
+    codec->dict[codec->dict_size++] = (uint16_t) identifier;
+    return (0);
+}
+
+void nrfcan_codec_node(nrfcan_codec_t *codec, uint8_t node) {
+    /* Node relative entries are encoded only once node id is known */
+    codec->node = node;
+}
+
+int nrfcan_codec_encode(const nrfcan_codec_t *codec, const nrfcan_frame_t *frame, uint8_t *buf, uint8_t size) {
+    uint8_t index;
+    int     entry;
+
+    if ((frame->dlc > 8) || (size < NRFCAN_CODEC_FRAME_MAX)) {
+        return (-1);
+    }
+
+    index = 0;
+    if (codec->version >= NRFCAN_CODEC_V2) {
+        entry = nrfcan_codec_dict_find(codec, frame->identifier);
+        if (entry >= 0) {
+            buf[index++] = NRFCAN_V2_DICT | ((entry + 1) << 4) | frame->dlc;
+        } else if (frame->identifier > 0x7ff) {
+            buf[index++] = NRFCAN_V2_EXT_ID | frame->dlc;
+            buf[index++] = ((frame->identifier >> 24) & 0x1f);
+            buf[index++] = ((frame->identifier >> 16) & 0xff);
+            buf[index++] = ((frame->identifier >> 8 ) & 0xff);
+            buf[index++] = ( frame->identifier        & 0xff);
+        } else {
+            buf[index++] = ((frame->dlc + NRFCAN_V2_DLC_OFFSET) << 3) | ((frame->identifier >> 8) & 0x07);
+            buf[index++] = ( frame->identifier        & 0xff);
+        }
+    } else {
+        if (frame->identifier > 0x7ff) {
+            buf[index++] = NRFCAN_DLC_EXT_ID | frame->dlc;
+            buf[index++] = ((frame->identifier >> 24) & 0xff);
+            buf[index++] = ((frame->identifier >> 16) & 0xff);
+            buf[index++] = ((frame->identifier >> 8 ) & 0xff);
+            buf[index++] = ( frame->identifier        & 0xff);
+        } else {
+            buf[index++] = frame->dlc;
+            buf[index++] = ((frame->identifier >> 8 ) & 0xff);
+            buf[index++] = ( frame->identifier        & 0xff);
+        }
+    }
+
+    memcpy(&buf[index], &frame->data[0], frame->dlc);
+    index += frame->dlc;
+
+    return (index);
+}
+
+int nrfcan_codec_append(uint8_t *payload, uint8_t *size, uint8_t max, const uint8_t *buf, uint8_t length) {
+    if (*size == 0) {
+        /* First frame */
+    } else if (nrfcan_codec_is_control(payload, *size) || nrfcan_codec_is_control(buf, length)) {
+        /* Control payloads are never merged */
+        return (-1);
+    } else if (nrfcan_codec_is_v2(payload, *size) != nrfcan_codec_is_v2(buf, length)) {
+        /* Formats can not be mixed in one payload */
+        return (-1);
+    }
+
+    if ((*size + length) > max) {
+        return (-1);
+    }
+    memcpy(&payload[*size], &buf[0], length);
+    *size += length;
+
+    return (0);
+}
+
+int nrfcan_codec_decode(const nrfcan_codec_t *codec, const uint8_t *payload, uint8_t size, uint8_t *pos, uint8_t source, nrfcan_frame_t *frame) {
+    uint8_t index = *pos;
+    uint8_t header;
+
+    if (nrfcan_codec_is_v2(payload, size)) {
+        if (index >= size) {
+            goto malformed;
+        }
+        header = payload[index++];
+        frame->dlc = header & 0x0f;
+        if ((header & NRFCAN_V2_EXT_ID) == NRFCAN_V2_EXT_ID) {
+            if ((size - index) < 4) {
+                goto malformed;
+            }
+            frame->identifier = ((uint32_t) (payload[index    ] & 0x1f) << 24) |
+                                ((uint32_t) (payload[index + 1]       ) << 16) |
+                                ((uint32_t) (payload[index + 2]       ) << 8 ) |
+                                ((uint32_t) (payload[index + 3]       )      ) ;
+            index += 4;
+        } else if (header & NRFCAN_V2_DICT) {
+            /* Index follows local dictionary regardless of what is sent */
+            if (nrfcan_codec_dict_entry(codec, ((header >> 4) & 0x07) - 1, source, &frame->identifier) < 0) {
+                goto malformed;
+            }
+        } else {
+            if (((size - index) < 1) || (((header >> 3) & 0x0f) < NRFCAN_V2_DLC_OFFSET)) {
+                goto malformed;
+            }
+            frame->dlc = ((header >> 3) & 0x0f) - NRFCAN_V2_DLC_OFFSET;
+            frame->identifier = ((header & 0x07) << 8) | payload[index++];
+        }
+    } else {
+        if ((size - index) < 3) {
+            goto malformed;
+        }
+        header = payload[index];
+        if (header & NRFCAN_DLC_EXT_ID) {
+            if ((size - index) < 5) {
+                goto malformed;
+            }
+            frame->dlc = header & ~(NRFCAN_DLC_EXT_ID);
+            frame->identifier = ((uint32_t) payload[index + 1] << 24) |
+                                ((uint32_t) payload[index + 2] << 16) |
+                                ((uint32_t) payload[index + 3] << 8 ) |
+                                ((uint32_t) payload[index + 4]      ) ;
+            index += 5;
+        } else {
+            frame->dlc = header;
+            frame->identifier = (payload[index + 1] << 8) |
+                                (payload[index + 2]     ) ;
+            index += 3;
+        }
+    }
+
+    if ((frame->dlc > 8) || ((size - index) < frame->dlc)) {
+        goto malformed;
+    }
+    memcpy(&frame->data[0], &payload[index], frame->dlc);
+    *pos = index + frame->dlc;
+
+    return (0);
+
+malformed:
+    /* Rest of the payload can not be trusted */
+    *pos = size;
+    return (-1);
+}
+
+int nrfcan_codec_remove(uint8_t *payload, uint8_t *size, uint8_t from, uint8_t to) {
+    if ((from > to) || (to > *size)) {
+        return (-1);
+    }
+    memmove(&payload[from], &payload[to], *size - to);
+    *size -= to - from;
+
+    /* Next frame now starts here */
+    return (from);
+}
+
+int nrfcan_codec_is_control(const uint8_t *payload, uint8_t size) {
+    return ((size > 1) && (payload[0] == NRFCAN_CONTROL));
+}
+
+int nrfcan_codec_is_v2(const uint8_t *payload, uint8_t size) {
+    return ((size > 0) && (payload[0] != NRFCAN_CONTROL) && (payload[0] & NRFCAN_V2_MASK));
+}
+
+int nrfcan_codec_link(uint8_t source, uint8_t seq, uint8_t *buf, uint8_t size) {
+    if ((size < NRFCAN_CODEC_LINK_SIZE) || (source > 0x7f)) {
+        return (-1);
+    }
+    buf[0] = NRFCAN_LINK | (source >> 2);
+    buf[1] = ((source & 0x03) << 6) | (seq & (NRFCAN_CODEC_SEQ_NUM - 1));
+
+    return (NRFCAN_CODEC_LINK_SIZE);
+}
+
+int nrfcan_codec_on_link(uint8_t *payload, uint8_t *size, uint8_t *source, uint8_t *seq) {
+    if ((*size == 0) || ((payload[0] & NRFCAN_LINK_MASK) != NRFCAN_LINK)) {
+        return (0);
+    }
+    if (*size < NRFCAN_CODEC_LINK_SIZE) {
+        return (-1);
+    }
+    *source = ((payload[0] & 0x1f) << 2) | (payload[1] >> 6);
+    *seq = payload[1] & (NRFCAN_CODEC_SEQ_NUM - 1);
+
+    /* Rest of the stack never sees link header */
+    *size -= NRFCAN_CODEC_LINK_SIZE;
+    memmove(&payload[0], &payload[NRFCAN_CODEC_LINK_SIZE], *size);
+
+    return (1);
+}
+
+int nrfcan_codec_hello(const nrfcan_codec_t *codec, uint8_t type, uint8_t *buf, uint8_t size) {
+    uint8_t index = NRFCAN_HELLO_HEADER;
+
+    if (size < (NRFCAN_HELLO_HEADER + (2u * codec->dict_size))) {
+        return (-1);
+    }
+    buf[0] = NRFCAN_CONTROL;
+    buf[1] = type;
+    buf[2] = codec->version_max;
+    buf[3] = codec->dict_size;
+    for (uint8_t i = 0; i < codec->dict_size; i++) {
+        buf[index++] = (codec->dict[i] >> 8) & 0xff;
+        buf[index++] = (codec->dict[i]     ) & 0xff;
+    }
+
+    return (index);
+}
+
+int nrfcan_codec_on_control(nrfcan_codec_t *codec, const uint8_t *payload, uint8_t size) {
+    uint8_t  count;
+    uint16_t entry;
+
+    if (!nrfcan_codec_is_control(payload, size)) {
+        return (-1);
+    }
+    if ((payload[1] != NRFCAN_CODEC_HELLO) && (payload[1] != NRFCAN_CODEC_HELLO_REPLY)) {
+        /* Not a codec control message */
+        return (0);
+    }
+    if (size < NRFCAN_HELLO_HEADER) {
+        return (-1);
+    }
+    count = payload[3];
+    if (size < (NRFCAN_HELLO_HEADER + (2u * count))) {
+        return (-1);
+    }
+
+    /* All peers share one address, so every one of them must understand
+     * what is sent. Lowest format ever announced wins */
+    if ((codec->version_heard == 0) || (payload[2] < codec->version_heard)) {
+        codec->version_heard = payload[2];
+    }
+    codec->version = (codec->version_heard < codec->version_max) ? codec->version_heard : codec->version_max;
+    if (codec->version < NRFCAN_CODEC_V1) {
+        codec->version = NRFCAN_CODEC_V1;
+    }
+    /* Entry stays in use only while every peer lists the same one at its
+     * position, once dropped it never comes back */
+    if (payload[2] >= NRFCAN_CODEC_V2) {
+        for (uint8_t i = 0; i < codec->dict_size; i++) {
+            entry = (i < count) ? ((payload[NRFCAN_HELLO_HEADER + (2 * i)] << 8) | payload[NRFCAN_HELLO_HEADER + (2 * i) + 1]) : 0xffff;
+            if (entry != codec->dict[i]) {
+                codec->dict_mask &= ~(1u << i);
+            }
+        }
+    }
+
+    /* Reply to announcement so that its sender learns about us */
+    return (payload[1] == NRFCAN_CODEC_HELLO) ? 1 : 0;
+}
+
+int nrfcan_codec_rate(uint8_t seq, uint8_t rate, uint16_t delay, uint8_t *buf, uint8_t size) {
+    if (size < NRFCAN_CODEC_RATE_SIZE) {
+        return (-1);
+    }
+    buf[0] = NRFCAN_CONTROL;
+    buf[1] = NRFCAN_CODEC_RATE;
+    buf[2] = seq;
+    buf[3] = rate;
+    buf[4] = (delay >> 8) & 0xff;
+    buf[5] = (delay     ) & 0xff;
+
+    return (NRFCAN_CODEC_RATE_SIZE);
+}
+
+int nrfcan_codec_on_rate(const uint8_t *payload, uint8_t size, uint8_t *seq, uint8_t *rate, uint16_t *delay) {
+    if (!nrfcan_codec_is_control(payload, size) || (payload[1] != NRFCAN_CODEC_RATE)) {
+        return (0);
+    }
+    if (size < NRFCAN_CODEC_RATE_SIZE) {
+        return (-1);
+    }
+    *seq = payload[2];
+    *rate = payload[3];
+    *delay = (payload[4] << 8) | payload[5];
+
+    return (1);
+}
+
+static int nrfcan_codec_dict_find(const nrfcan_codec_t *codec, uint32_t identifier) {
+    uint32_t entry;
+
+    for (uint8_t i = 0; i < codec->dict_size; i++) {
+        if (!(codec->dict_mask & (1u << i))) {
+            continue;
+        }
+        entry = codec->dict[i];
+        if (entry & NRFCAN_CODEC_DICT_NODE) {
+            if (codec->node == 0) {
+                continue;
+            }
+            entry = (entry & 0x7ff) + codec->node;
+        }
+        if (entry == identifier) {
+            return (i);
+        }
+    }
+    return (-1);
+}
+
+static int nrfcan_codec_dict_entry(const nrfcan_codec_t *codec, uint8_t entry, uint8_t source, uint32_t *identifier) {
+    if ((entry >= codec->dict_size) || !(codec->dict_mask & (1u << entry))) {
+        return (-1);
+    }
+    *identifier = codec->dict[entry];
+    if (*identifier & NRFCAN_CODEC_DICT_NODE) {
+        if (source == 0) {
+            /* Sender is not known, nothing to add the function code to */
+            return (-1);
+        }
+        *identifier = (*identifier & 0x7ff) + source;
+    }
+    return (0);
+}
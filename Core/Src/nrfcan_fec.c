@@ -0,0 +1,259 @@
+/**
+ ******************************************************************************
+ * @file        nrfcan_fec.c
+ * @author      Zoltan Dolensky
+ * @brief       
+ *
+ ******************************************************************************
+ * @attention
+ *
+ * MIT License
+ * -----------
+ * Copyright (c) 2022 Technical university of Liberec (https://tul.cz)
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ ******************************************************************************
+ */
+
+/*
+ * Shortened Reed-Solomon code over GF(256), primitive polynomial 0x11d and
+ * first consecutive root 1. Parity bytes follow data, so protected payload
+ * still starts with its format byte. Each two parity bytes correct one
+ * damaged byte anywhere in the codeword, no matter how many of its bits
+ * are wrong.
+ *
+ * Codeword byte 0 is the highest coefficient, byte at index j belongs to
+ * power (size - 1 - j).
+ */
+
+#include <string.h>
+
+#include "nrfcan_fec.h"
+
+#define NRFCAN_FEC_POLY             (0x11d)
+
+static uint8_t      nrfcan_fec_mul(uint8_t a, uint8_t b);
+
+static uint8_t      nrfcan_fec_div(uint8_t a, uint8_t b);
+
+/* Exponent table is doubled so that sum of two logarithms needs no modulo */
+static uint8_t      gf_exp[512];
+static uint8_t      gf_log[256];
+static uint8_t      gf_ready = 0;
+
+int nrfcan_fec_init(nrfcan_fec_t *fec, uint8_t parity) {
+    uint16_t x = 1;
+
+    if ((parity == 0) || (parity > NRFCAN_FEC_PARITY_MAX)) {
+        return (-1);
+    }
+
+    if (!gf_ready) {
+        for (uint16_t i = 0; i < 255; i++) {
+            gf_exp[i] = (uint8_t) x;
+            gf_log[x] = (uint8_t) i;
+            x <<= 1;
+            if (x & 0x100) {
+                x ^= NRFCAN_FEC_POLY;
+            }
+        }
+        for (uint16_t i = 255; i < sizeof(gf_exp); i++) {
+            gf_exp[i] = gf_exp[i - 255];
+        }
+        gf_ready = 1;
+    }
+
+    /* Generator is product of (x - a^i) for i = 0 .. parity - 1,
+     * stored lowest coefficient first, leading one is implied */
+    memset(fec, 0, sizeof(nrfcan_fec_t));
+    fec->parity = parity;
+    fec->generator[0] = 1;
+    for (uint8_t i = 0; i < parity; i++) {
+        for (uint8_t j = i + 1; j > 0; j--) {
+            fec->generator[j] = fec->generator[j - 1] ^ nrfcan_fec_mul(fec->generator[j], gf_exp[i]);
+        }
+        fec->generator[0] = nrfcan_fec_mul(fec->generator[0], gf_exp[i]);
+    }
+    return (0);
+}
+
+int nrfcan_fec_encode(const nrfcan_fec_t *fec, uint8_t *buf, uint8_t length, uint8_t size) {
+    uint8_t *parity = &buf[length];
+    uint8_t  feedback;
+
+    if (((uint16_t) length + fec->parity) > size) {
+        return (-1);
+    }
+
+    /* Remainder of data shifted by parity length divided by generator,
+     * parity[0] holds the highest coefficient */
+    memset(parity, 0, fec->parity);
+    for (uint8_t i = 0; i < length; i++) {
+        feedback = buf[i] ^ parity[0];
+        memmove(&parity[0], &parity[1], fec->parity - 1);
+        parity[fec->parity - 1] = 0;
+        if (feedback != 0) {
+            for (uint8_t j = 0; j < fec->parity; j++) {
+                parity[j] ^= nrfcan_fec_mul(fec->generator[fec->parity - 1 - j], feedback);
+            }
+        }
+    }
+    return (length + fec->parity);
+}
+
+int nrfcan_fec_decode(const nrfcan_fec_t *fec, uint8_t *buf, uint8_t size) {
+    uint8_t syndrome[NRFCAN_FEC_PARITY_MAX];
+    uint8_t locator[NRFCAN_FEC_PARITY_MAX + 1];
+    uint8_t previous[NRFCAN_FEC_PARITY_MAX + 1];
+    uint8_t scratch[NRFCAN_FEC_PARITY_MAX + 1];
+    uint8_t evaluator[NRFCAN_FEC_PARITY_MAX];
+    uint8_t position[NRFCAN_FEC_PARITY_MAX / 2];
+    uint8_t errors = 0;
+    uint8_t degree = 0;
+    uint8_t shift = 1;
+    uint8_t scale = 1;
+    uint8_t delta;
+    uint8_t value;
+    uint8_t inverse;
+    uint8_t power;
+    uint8_t any = 0;
+
+    if (size <= fec->parity) {
+        return (-1);
+    }
+
+    /* Syndromes are received polynomial evaluated at generator roots */
+    for (uint8_t i = 0; i < fec->parity; i++) {
+        value = 0;
+        for (uint8_t j = 0; j < size; j++) {
+            value = nrfcan_fec_mul(value, gf_exp[i]) ^ buf[j];
+        }
+        syndrome[i] = value;
+        any |= value;
+    }
+    if (any == 0) {
+        /* Clean codeword, by far the most common case */
+        return (0);
+    }
+
+    /* Berlekamp-Massey, error locator polynomial lowest coefficient first */
+    memset(locator, 0, sizeof(locator));
+    memset(previous, 0, sizeof(previous));
+    locator[0] = 1;
+    previous[0] = 1;
+    for (uint8_t r = 0; r < fec->parity; r++) {
+        delta = syndrome[r];
+        for (uint8_t i = 1; i <= degree; i++) {
+            delta ^= nrfcan_fec_mul(locator[i], syndrome[r - i]);
+        }
+        if (delta == 0) {
+            shift++;
+            continue;
+        }
+        value = nrfcan_fec_div(delta, scale);
+        if ((2 * degree) <= r) {
+            memcpy(scratch, locator, sizeof(locator));
+            for (uint8_t i = 0; (i + shift) <= fec->parity; i++) {
+                locator[i + shift] ^= nrfcan_fec_mul(value, previous[i]);
+            }
+            degree = r + 1 - degree;
+            memcpy(previous, scratch, sizeof(previous));
+            scale = delta;
+            shift = 1;
+        } else {
+            for (uint8_t i = 0; (i + shift) <= fec->parity; i++) {
+                locator[i + shift] ^= nrfcan_fec_mul(value, previous[i]);
+            }
+            shift++;
+        }
+    }
+    if ((2 * degree) > fec->parity) {
+        return (-1);
+    }
+
+    /* Chien search, byte at index j is damaged when locator has root a^-(size - 1 - j) */
+    for (uint8_t j = 0; j < size; j++) {
+        power = size - 1 - j;
+        inverse = gf_exp[(255 - power) % 255];
+        value = 0;
+        for (uint8_t i = degree + 1; i > 0; i--) {
+            value = nrfcan_fec_mul(value, inverse) ^ locator[i - 1];
+        }
+        if (value == 0) {
+            if (errors >= degree) {
+                return (-1);
+            }
+            position[errors++] = j;
+        }
+    }
+    if (errors != degree) {
+        /* Locator roots lie outside of shortened codeword, too many errors */
+        return (-1);
+    }
+
+    /* Error evaluator is syndrome polynomial times locator modulo x^parity */
+    for (uint8_t i = 0; i < fec->parity; i++) {
+        value = 0;
+        for (uint8_t k = 0; (k <= i) && (k <= degree); k++) {
+            value ^= nrfcan_fec_mul(locator[k], syndrome[i - k]);
+        }
+        evaluator[i] = value;
+    }
+
+    /* Forney, magnitude is X * evaluator(X^-1) / locator'(X^-1) */
+    for (uint8_t e = 0; e < errors; e++) {
+        uint8_t numerator = 0;
+        uint8_t denominator = 0;
+        uint8_t x;
+
+        power = size - 1 - position[e];
+        inverse = gf_exp[(255 - power) % 255];
+        for (uint8_t i = fec->parity; i > 0; i--) {
+            numerator = nrfcan_fec_mul(numerator, inverse) ^ evaluator[i - 1];
+        }
+        /* Formal derivative keeps only odd powers */
+        x = 1;
+        for (uint8_t i = 1; i <= degree; i += 2) {
+            denominator ^= nrfcan_fec_mul(locator[i], x);
+            x = nrfcan_fec_mul(x, nrfcan_fec_mul(inverse, inverse));
+        }
+        if (denominator == 0) {
+            return (-1);
+        }
+        buf[position[e]] ^= nrfcan_fec_mul(gf_exp[power], nrfcan_fec_div(numerator, denominator));
+    }
+    return (errors);
+}
+
+static uint8_t nrfcan_fec_mul(uint8_t a, uint8_t b) {
+    if ((a == 0) || (b == 0)) {
+        return (0);
+    }
+    return gf_exp[gf_log[a] + gf_log[b]];
+}
+
+static uint8_t nrfcan_fec_div(uint8_t a, uint8_t b) {
+    if (a == 0) {
+        return (0);
+    }
+    return gf_exp[gf_log[a] + 255 - gf_log[b]];
+}
@@ -0,0 +1,162 @@
+/**
+ ******************************************************************************
+ * @file        nrfcan_ring.c
+ * @author      Zoltan Dolensky
+ * @brief       
+ *
+ ******************************************************************************
+ * @attention
+ *
+ * MIT License
+ * -----------
+ * Copyright (c) 2022 Technical university of Liberec (https://tul.cz)
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ ******************************************************************************
+ */
+
+/*
+ * Single producer, single consumer ring of variable length records. Producer
+ * owns head and consumer owns tail, so neither side needs a critical section.
+ * Records are reserved in place, data never has to be copied through the ring.
+ *
+ * Record is a length byte padded to NRFCAN_RING_ALIGN followed by data, which
+ * is padded as well, so data of every record is aligned for its structure.
+ * Record is never split, when it does not fit before end of the buffer, zero
+ * length marker sends consumer back to the beginning, hence records must not
+ * be empty.
+ */
+
+#include "nrfcan_ring.h"
+
+/* Order record accesses against publication of the index */
+#define NRFCAN_RING_BARRIER()       __sync_synchronize()
+
+/* Bytes taken by record of given length including its header */
+#define NRFCAN_RING_SPAN(length)    (NRFCAN_RING_ALIGN + \
+                                     (((length) + NRFCAN_RING_ALIGN - 1u) & ~(NRFCAN_RING_ALIGN - 1u)))
+
+void nrfcan_ring_init(nrfcan_ring_t *ring, void *buff, uint16_t size) {
+    ring->buff = (uint8_t*) buff;
+    ring->size = size;
+    ring->head = 0;
+    ring->tail = 0;
+    ring->next = 0;
+    ring->produced = 0;
+    ring->consumed = 0;
+    ring->hwm_bytes = 0;
+    ring->hwm_frames = 0;
+}
+
+void* nrfcan_ring_reserve(nrfcan_ring_t *ring, uint8_t length) {
+    uint16_t head = ring->head;
+    uint16_t tail = ring->tail;
+    uint16_t need = NRFCAN_RING_SPAN(length);
+
+    /* Head must never catch up with tail, that would look like empty ring */
+    if (head >= tail) {
+        if (((head + need) < ring->size) || (((head + need) == ring->size) && (tail > 0))) {
+            ring->next = head;
+        } else if (need < tail) {
+            ring->next = 0;
+        } else {
+            return (0);
+        }
+    } else if ((head + need) < tail) {
+        ring->next = head;
+    } else {
+        return (0);
+    }
+    return &ring->buff[ring->next + NRFCAN_RING_ALIGN];
+}
+
+void nrfcan_ring_commit(nrfcan_ring_t *ring, uint8_t length) {
+    uint16_t head = ring->head;
+    uint16_t bytes;
+    uint16_t frames;
+
+    ring->buff[ring->next] = length;
+    if (ring->next != head) {
+        /* Record was placed at the beginning, leave wrap marker behind */
+        ring->buff[head] = 0;
+    }
+    head = ring->next + NRFCAN_RING_SPAN(length);
+    if (head == ring->size) {
+        head = 0;
+    }
+    NRFCAN_RING_BARRIER();
+    ring->head = head;
+    ring->produced = ring->produced + 1;
+
+    bytes = nrfcan_ring_bytes(ring);
+    frames = nrfcan_ring_frames(ring);
+    if (bytes > ring->hwm_bytes) {
+        ring->hwm_bytes = bytes;
+    }
+    if (frames > ring->hwm_frames) {
+        ring->hwm_frames = frames;
+    }
+}
+
+uint16_t nrfcan_ring_cursor(nrfcan_ring_t *ring) {
+    return ring->tail;
+}
+
+void* nrfcan_ring_peek(nrfcan_ring_t *ring, uint16_t *cursor, uint8_t *length) {
+    uint16_t head = ring->head;
+    uint16_t index = *cursor;
+
+    NRFCAN_RING_BARRIER();
+    if (index == head) {
+        return (0);
+    }
+    if (ring->buff[index] == 0) {
+        /* Wrap marker */
+        index = 0;
+        if (index == head) {
+            return (0);
+        }
+    }
+    *length = ring->buff[index];
+    *cursor = index + NRFCAN_RING_SPAN(*length);
+    if (*cursor == ring->size) {
+        *cursor = 0;
+    }
+    return &ring->buff[index + NRFCAN_RING_ALIGN];
+}
+
+void nrfcan_ring_release(nrfcan_ring_t *ring, uint16_t cursor, uint16_t count) {
+    NRFCAN_RING_BARRIER();
+    ring->tail = cursor;
+    ring->consumed = ring->consumed + count;
+}
+
+uint16_t nrfcan_ring_bytes(nrfcan_ring_t *ring) {
+    uint16_t head = ring->head;
+    uint16_t tail = ring->tail;
+
+    return (head >= tail) ? (head - tail) : (ring->size - tail + head);
+}
+
+uint16_t nrfcan_ring_frames(nrfcan_ring_t *ring) {
+    return (uint16_t) (ring->produced - ring->consumed);
+}
@@ -0,0 +1,314 @@
+/**
+ ******************************************************************************
+ * @file        nrfcan_codec_test.c
+ * @author      Zoltan Dolensky
+ * @brief       
+ *
+ ******************************************************************************
+ * @attention
+ *
+ * MIT License
+ * -----------
+ * Copyright (c) 2022 Technical university of Liberec (https://tul.cz)
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ ******************************************************************************
+ */
+
+/*
+ * Host test and benchmark of the frame codec: both formats must carry
+ * every identifier and length, aggregated payloads must split back into
+ * the original frames and negotiation must settle on what all peers
+ * understand.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "nrfcan_codec.h"
+
+#define TEST_BENCH_LOOPS            (1000000u)
+
+#define CHECK(c)                    do { if (!(c)) { printf("%s:%d: %s\n", __FILE__, __LINE__, #c); failures++; } } while (0)
+
+static int failures = 0;
+
+static void test_roundtrip(uint8_t version, uint8_t dict);
+static void test_aggregate(void);
+static void test_negotiate(void);
+static void test_link(void);
+static void test_bench(void);
+
+static void test_hello(nrfcan_codec_t *codec, const nrfcan_codec_t *peer) {
+    uint8_t buf[NRFCAN_CODEC_HELLO_SIZE];
+    int     size;
+
+    size = nrfcan_codec_hello(peer, NRFCAN_CODEC_HELLO, buf, sizeof(buf));
+    nrfcan_codec_on_control(codec, buf, size);
+}
+
+#define TEST_NODE                   (0x12u)
+
+static void test_dict(nrfcan_codec_t *codec) {
+    nrfcan_codec_dict_add(codec, 0x000);
+    nrfcan_codec_dict_add(codec, 0x080);
+    nrfcan_codec_dict_add(codec, NRFCAN_CODEC_DICT_NODE | 0x700);
+    nrfcan_codec_node(codec, TEST_NODE);
+}
+
+int main(void) {
+    test_roundtrip(NRFCAN_CODEC_V1, 0);
+    test_roundtrip(NRFCAN_CODEC_V2, 0);
+    test_roundtrip(NRFCAN_CODEC_V2, 1);
+    test_aggregate();
+    test_negotiate();
+    test_link();
+    test_bench();
+
+    printf("%s\n", (failures == 0) ? "PASS" : "FAIL");
+    return (failures == 0) ? 0 : 1;
+}
+
+static void test_roundtrip(uint8_t version, uint8_t dict) {
+    static const uint32_t identifiers[] = { 0x000, 0x080, 0x100, 0x181, 0x602, 0x700 + TEST_NODE, 0x7ff, 0x800, 0x1fffffff };
+    nrfcan_codec_t codec;
+    nrfcan_frame_t frame;
+    nrfcan_frame_t decoded;
+    uint8_t        buf[NRFCAN_CODEC_FRAME_MAX];
+    uint8_t        pos;
+    int            size;
+
+    nrfcan_codec_init(&codec, version);
+    if (dict) {
+        test_dict(&codec);
+    }
+    /* Peer with the same capabilities */
+    test_hello(&codec, &codec);
+    CHECK(codec.version == version);
+    CHECK(codec.dict_mask == (dict ? 0x07 : 0x00));
+
+    for (uint8_t i = 0; i < (sizeof(identifiers) / sizeof(identifiers[0])); i++) {
+        for (uint8_t dlc = 0; dlc <= 8; dlc++) {
+            frame.identifier = identifiers[i];
+            frame.dlc = dlc;
+            for (uint8_t k = 0; k < 8; k++) {
+                frame.data[k] = (uint8_t) (i * 16 + k);
+            }
+            size = nrfcan_codec_encode(&codec, &frame, buf, sizeof(buf));
+            CHECK(size > 0);
+            pos = 0;
+            CHECK(nrfcan_codec_decode(&codec, buf, size, &pos, TEST_NODE, &decoded) == 0);
+            CHECK(pos == size);
+            CHECK(decoded.identifier == frame.identifier);
+            CHECK(decoded.dlc == frame.dlc);
+            CHECK(memcmp(decoded.data, frame.data, dlc) == 0);
+        }
+    }
+    /* Header cost of a lone frame */
+    frame.dlc = 0;
+    frame.identifier = 0x181;
+    size = nrfcan_codec_encode(&codec, &frame, buf, sizeof(buf));
+    CHECK(size == ((version == NRFCAN_CODEC_V1) ? 3 : 2));
+    frame.identifier = 0x1fffffff;
+    size = nrfcan_codec_encode(&codec, &frame, buf, sizeof(buf));
+    CHECK(size == 5);
+    frame.identifier = 0x080;
+    size = nrfcan_codec_encode(&codec, &frame, buf, sizeof(buf));
+    CHECK(size == ((version == NRFCAN_CODEC_V1) ? 3 : (dict ? 1 : 2)));
+    frame.identifier = 0x700 + TEST_NODE;
+    size = nrfcan_codec_encode(&codec, &frame, buf, sizeof(buf));
+    CHECK(size == ((version == NRFCAN_CODEC_V1) ? 3 : (dict ? 1 : 2)));
+    if (dict) {
+        /* Node relative entry decodes to the sender's object */
+        pos = 0;
+        CHECK(nrfcan_codec_decode(&codec, buf, size, &pos, 0x05, &decoded) == 0);
+        CHECK(decoded.identifier == 0x705);
+        pos = 0;
+        CHECK(nrfcan_codec_decode(&codec, buf, size, &pos, 0, &decoded) < 0);
+    }
+    printf("roundtrip V%u%s done\n", version, dict ? " with dictionary" : "");
+}
+
+static void test_aggregate(void) {
+    static const uint32_t identifiers[] = { 0x181, 0x080, 0x602, 0x700 + TEST_NODE };
+    nrfcan_codec_t codec;
+    nrfcan_frame_t frame;
+    uint8_t        payload[32];
+    uint8_t        buf[NRFCAN_CODEC_FRAME_MAX];
+    uint8_t        size = 0;
+    uint8_t        pos = 0;
+    uint8_t        start;
+    uint8_t        count = 0;
+    int            length;
+
+    nrfcan_codec_init(&codec, NRFCAN_CODEC_V2);
+    test_dict(&codec);
+    test_hello(&codec, &codec);
+
+    for (uint8_t i = 0; i < (sizeof(identifiers) / sizeof(identifiers[0])); i++) {
+        frame.identifier = identifiers[i];
+        frame.dlc = 2;
+        frame.data[0] = i;
+        length = nrfcan_codec_encode(&codec, &frame, buf, sizeof(buf));
+        CHECK(nrfcan_codec_append(payload, &size, sizeof(payload), buf, length) == 0);
+    }
+
+    /* Cut out everything but SDO, the rest must still decode */
+    while (pos < size) {
+        start = pos;
+        CHECK(nrfcan_codec_decode(&codec, payload, size, &pos, TEST_NODE, &frame) == 0);
+        if (frame.identifier != 0x602) {
+            pos = nrfcan_codec_remove(payload, &size, start, pos);
+        }
+    }
+    pos = 0;
+    while (pos < size) {
+        CHECK(nrfcan_codec_decode(&codec, payload, size, &pos, TEST_NODE, &frame) == 0);
+        CHECK((frame.identifier == 0x602) && (frame.data[0] == 2));
+        count++;
+    }
+    CHECK(count == 1);
+
+    /* Control payloads are never merged */
+    length = nrfcan_codec_hello(&codec, NRFCAN_CODEC_HELLO, buf, sizeof(buf));
+    CHECK(nrfcan_codec_append(payload, &size, sizeof(payload), buf, length) < 0);
+    printf("aggregate done\n");
+}
+
+static void test_negotiate(void) {
+    nrfcan_codec_t codec;
+    nrfcan_codec_t v1;
+    nrfcan_codec_t v2;
+    nrfcan_codec_t other;
+    nrfcan_frame_t frame = { .identifier = 0x080, .dlc = 0 };
+    nrfcan_frame_t decoded;
+    uint8_t        buf[NRFCAN_CODEC_FRAME_MAX];
+    uint8_t        pos;
+
+    nrfcan_codec_init(&codec, NRFCAN_CODEC_V2);
+    nrfcan_codec_init(&v1, NRFCAN_CODEC_V1);
+    nrfcan_codec_init(&v2, NRFCAN_CODEC_V2);
+    nrfcan_codec_init(&other, NRFCAN_CODEC_V2);
+    test_dict(&codec);
+    test_dict(&v1);
+    test_dict(&v2);
+    nrfcan_codec_dict_add(&other, 0x000);
+    nrfcan_codec_dict_add(&other, 0x100);
+
+    /* Stays on V1 until somebody announces more, indexes sent by peers
+     * are understood meanwhile */
+    CHECK(codec.version == NRFCAN_CODEC_V1);
+    test_hello(&v2, &codec);
+    CHECK(nrfcan_codec_encode(&v2, &frame, buf, sizeof(buf)) == 1);
+    pos = 0;
+    CHECK(nrfcan_codec_decode(&codec, buf, 1, &pos, 0, &decoded) == 0);
+    CHECK(decoded.identifier == 0x080);
+    test_hello(&codec, &v2);
+    CHECK((codec.version == NRFCAN_CODEC_V2) && (codec.dict_mask == 0x07));
+
+    /* Any V1 peer pulls everyone down, later V2 hellos do not undo it */
+    test_hello(&codec, &v1);
+    CHECK(codec.version == NRFCAN_CODEC_V1);
+    test_hello(&codec, &v2);
+    CHECK(codec.version == NRFCAN_CODEC_V1);
+
+    /* Peer with a different dictionary turns off only entries which
+     * differ, for good */
+    nrfcan_codec_init(&codec, NRFCAN_CODEC_V2);
+    test_dict(&codec);
+    test_hello(&codec, &other);
+    CHECK((codec.version == NRFCAN_CODEC_V2) && (codec.dict_mask == 0x01));
+    test_hello(&codec, &v2);
+    CHECK(codec.dict_mask == 0x01);
+    CHECK(nrfcan_codec_encode(&codec, &frame, buf, sizeof(buf)) == 2);
+    printf("negotiate done\n");
+}
+
+static void test_link(void) {
+    nrfcan_codec_t codec;
+    nrfcan_frame_t frame;
+    uint8_t        payload[32];
+    uint8_t        size;
+    uint8_t        source;
+    uint8_t        seq;
+    int            length;
+
+    /* Every node id and sequence number survives the header */
+    for (uint8_t node = 1; node < 0x80; node++) {
+        for (uint8_t i = 0; i < NRFCAN_CODEC_SEQ_NUM; i++) {
+            size = nrfcan_codec_link(node, i, payload, sizeof(payload));
+            payload[size++] = 0x55;
+            CHECK(nrfcan_codec_on_link(payload, &size, &source, &seq) == 1);
+            CHECK((source == node) && (seq == i) && (size == 1) && (payload[0] == 0x55));
+        }
+    }
+
+    /* Payloads without header are left alone in every format */
+    for (uint8_t version = NRFCAN_CODEC_V1; version <= NRFCAN_CODEC_V2; version++) {
+        nrfcan_codec_init(&codec, version);
+        test_dict(&codec);
+        test_hello(&codec, &codec);
+        for (uint32_t identifier = 0; identifier <= 0x7ff; identifier++) {
+            for (uint8_t dlc = 0; dlc <= 8; dlc++) {
+                frame.identifier = (identifier == 0x7ff) ? 0x1fffffff : identifier;
+                frame.dlc = dlc;
+                length = nrfcan_codec_encode(&codec, &frame, payload, sizeof(payload));
+                size = (uint8_t) length;
+                CHECK(nrfcan_codec_on_link(payload, &size, &source, &seq) == 0);
+                CHECK(nrfcan_codec_is_v2(payload, size) == (version == NRFCAN_CODEC_V2));
+            }
+        }
+    }
+    size = nrfcan_codec_hello(&codec, NRFCAN_CODEC_HELLO, payload, sizeof(payload));
+    CHECK(nrfcan_codec_on_link(payload, &size, &source, &seq) == 0);
+    printf("link done\n");
+}
+
+static void test_bench(void) {
+    nrfcan_codec_t   codec;
+    nrfcan_frame_t   frame = { .identifier = 0x181, .dlc = 8 };
+    nrfcan_frame_t   decoded;
+    uint8_t          buf[NRFCAN_CODEC_FRAME_MAX];
+    uint8_t          pos;
+    volatile int     sink = 0;
+    clock_t          start;
+    int              size;
+
+    nrfcan_codec_init(&codec, NRFCAN_CODEC_V2);
+    test_hello(&codec, &codec);
+
+    start = clock();
+    for (uint32_t i = 0; i < TEST_BENCH_LOOPS; i++) {
+        sink += nrfcan_codec_encode(&codec, &frame, buf, sizeof(buf));
+    }
+    printf("encode:            %6.1f ns\n", (double) (clock() - start) * 1e9 / CLOCKS_PER_SEC / TEST_BENCH_LOOPS);
+
+    size = nrfcan_codec_encode(&codec, &frame, buf, sizeof(buf));
+    start = clock();
+    for (uint32_t i = 0; i < TEST_BENCH_LOOPS; i++) {
+        pos = 0;
+        sink += nrfcan_codec_decode(&codec, buf, size, &pos, 0, &decoded);
+    }
+    printf("decode:            %6.1f ns\n", (double) (clock() - start) * 1e9 / CLOCKS_PER_SEC / TEST_BENCH_LOOPS);
+    (void) sink;
+}
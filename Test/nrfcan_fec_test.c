@@ -0,0 +1,178 @@
+/**
+ ******************************************************************************
+ * @file        nrfcan_fec_test.c
+ * @author      Zoltan Dolensky
+ * @brief       
+ *
+ ******************************************************************************
+ * @attention
+ *
+ * MIT License
+ * -----------
+ * Copyright (c) 2022 Technical university of Liberec (https://tul.cz)
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ ******************************************************************************
+ */
+
+/*
+ * Host test and benchmark of the Reed-Solomon kernel. Every pattern of up
+ * to parity / 2 damaged bytes must be corrected, heavier damage must not
+ * pass silently more often than chance allows.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "nrfcan_fec.h"
+
+#define TEST_PAYLOAD_SIZE           (32u)
+#define TEST_PATTERNS               (200000u)
+#define TEST_BENCH_LOOPS            (1000000u)
+
+static int  test_correct(uint8_t parity);
+static void test_overload(uint8_t parity);
+static void test_bench(void);
+
+int main(void) {
+    int failures = 0;
+
+    srand(1);
+    for (uint8_t parity = 2; parity <= 8; parity += 2) {
+        failures += test_correct(parity);
+        test_overload(parity);
+    }
+    test_bench();
+
+    printf("%s\n", (failures == 0) ? "PASS" : "FAIL");
+    return (failures == 0) ? 0 : 1;
+}
+
+static int test_correct(uint8_t parity) {
+    nrfcan_fec_t fec;
+    uint8_t      buf[TEST_PAYLOAD_SIZE];
+    uint8_t      orig[TEST_PAYLOAD_SIZE];
+    uint8_t      damaged[TEST_PAYLOAD_SIZE];
+    uint8_t      length;
+    uint8_t      errors;
+    uint8_t      pos;
+    int          size;
+    int          result;
+    int          failures = 0;
+
+    nrfcan_fec_init(&fec, parity);
+    for (uint32_t t = 0; t < TEST_PATTERNS; t++) {
+        length = 1 + (rand() % (TEST_PAYLOAD_SIZE - parity));
+        for (uint8_t i = 0; i < length; i++) {
+            buf[i] = rand();
+        }
+        size = nrfcan_fec_encode(&fec, buf, length, sizeof(buf));
+        memcpy(orig, buf, size);
+
+        /* Distinct positions, each byte gets a non-zero error value */
+        errors = rand() % ((parity / 2) + 1);
+        memset(damaged, 0, sizeof(damaged));
+        for (uint8_t e = 0; e < errors; ) {
+            pos = rand() % size;
+            if (!damaged[pos]) {
+                damaged[pos] = 1;
+                buf[pos] ^= 1 + (rand() % 255);
+                e++;
+            }
+        }
+
+        result = nrfcan_fec_decode(&fec, buf, size);
+        if ((result != errors) || memcmp(buf, orig, size)) {
+            if (failures < 5) {
+                printf("parity %u length %u errors %u: decode returned %d\n", parity, length, errors, result);
+            }
+            failures++;
+        }
+    }
+    printf("parity %u: %u patterns, %d failures\n", parity, TEST_PATTERNS, failures);
+    return failures;
+}
+
+static void test_overload(uint8_t parity) {
+    nrfcan_fec_t fec;
+    uint8_t      buf[TEST_PAYLOAD_SIZE];
+    uint8_t      orig[TEST_PAYLOAD_SIZE];
+    uint8_t      length;
+    uint32_t     detected = 0;
+    uint32_t     miscorrected = 0;
+    int          size;
+
+    nrfcan_fec_init(&fec, parity);
+    for (uint32_t t = 0; t < TEST_PATTERNS; t++) {
+        length = 1 + (rand() % (TEST_PAYLOAD_SIZE - parity));
+        for (uint8_t i = 0; i < length; i++) {
+            buf[i] = rand();
+        }
+        size = nrfcan_fec_encode(&fec, buf, length, sizeof(buf));
+        memcpy(orig, buf, size);
+        for (uint8_t e = 0; e < (parity / 2) + 1; e++) {
+            buf[rand() % size] ^= 1 + (rand() % 255);
+        }
+        if (nrfcan_fec_decode(&fec, buf, size) < 0) {
+            detected++;
+        } else if (memcmp(buf, orig, size)) {
+            miscorrected++;
+        }
+    }
+    /* Informative only, a code this short can not catch everything */
+    printf("parity %u overload: %u detected, %u miscorrected\n", parity, detected, miscorrected);
+}
+
+static void test_bench(void) {
+    nrfcan_fec_t     fec;
+    uint8_t          buf[TEST_PAYLOAD_SIZE];
+    volatile int     sink = 0;
+    clock_t          start;
+
+    nrfcan_fec_init(&fec, 4);
+    for (uint8_t i = 0; i < (TEST_PAYLOAD_SIZE - 4); i++) {
+        buf[i] = i;
+    }
+
+    start = clock();
+    for (uint32_t i = 0; i < TEST_BENCH_LOOPS; i++) {
+        sink += nrfcan_fec_encode(&fec, buf, TEST_PAYLOAD_SIZE - 4, sizeof(buf));
+    }
+    printf("encode 28+4:       %6.1f ns\n", (double) (clock() - start) * 1e9 / CLOCKS_PER_SEC / TEST_BENCH_LOOPS);
+
+    start = clock();
+    for (uint32_t i = 0; i < TEST_BENCH_LOOPS; i++) {
+        sink += nrfcan_fec_decode(&fec, buf, sizeof(buf));
+    }
+    printf("decode clean:      %6.1f ns\n", (double) (clock() - start) * 1e9 / CLOCKS_PER_SEC / TEST_BENCH_LOOPS);
+
+    start = clock();
+    for (uint32_t i = 0; i < TEST_BENCH_LOOPS; i++) {
+        buf[3] ^= 0x55;
+        buf[20] ^= 0x01;
+        sink += nrfcan_fec_decode(&fec, buf, sizeof(buf));
+    }
+    printf("decode two errors: %6.1f ns\n", (double) (clock() - start) * 1e9 / CLOCKS_PER_SEC / TEST_BENCH_LOOPS);
+    (void) sink;
+}
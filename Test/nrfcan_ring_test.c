@@ -0,0 +1,250 @@
+/**
+ ******************************************************************************
+ * @file        nrfcan_ring_test.c
+ * @author      Zoltan Dolensky
+ * @brief       
+ *
+ ******************************************************************************
+ * @attention
+ *
+ * MIT License
+ * -----------
+ * Copyright (c) 2022 Technical university of Liberec (https://tul.cz)
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ ******************************************************************************
+ */
+
+
+/*
+ * Host test of the record ring. Random producer and consumer steps are checked
+ * against a plain queue model, every record must come back intact, in order
+ * and aligned, including records placed behind a wrap marker and slots that
+ * were reserved but never committed.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "nrfcan_ring.h"
+
+#define TEST_STEPS                  (200000u)
+#define TEST_RECORD_MAX             (40u)
+#define TEST_MODEL_SIZE             (256u)
+
+typedef struct {
+    uint8_t     length[TEST_MODEL_SIZE];
+    uint8_t     seed[TEST_MODEL_SIZE];
+    uint32_t    head;
+    uint32_t    tail;
+} test_model_t;
+
+static int  test_random(uint16_t size);
+static int  test_uncommitted(void);
+static void test_fill(uint8_t *data, uint8_t length, uint8_t seed);
+static int  test_check(const uint8_t *data, uint8_t length, uint8_t seed);
+
+int main(void) {
+    int failures = 0;
+
+    srand(1);
+    failures += test_uncommitted();
+    failures += test_random(64);
+    failures += test_random(66);
+    failures += test_random(128);
+    failures += test_random(512);
+
+    printf("%s\n", (failures == 0) ? "PASS" : "FAIL");
+    return (failures == 0) ? 0 : 1;
+}
+
+static void test_fill(uint8_t *data, uint8_t length, uint8_t seed) {
+    for (uint8_t i = 0; i < length; i++) {
+        data[i] = seed + i;
+    }
+}
+
+static int test_check(const uint8_t *data, uint8_t length, uint8_t seed) {
+    for (uint8_t i = 0; i < length; i++) {
+        if (data[i] != (uint8_t) (seed + i)) {
+            return (1);
+        }
+    }
+    return (0);
+}
+
+static int test_random(uint16_t size) {
+    static uint16_t buff[512 / sizeof(uint16_t)];
+    nrfcan_ring_t   ring;
+    test_model_t    model = { 0 };
+    uint8_t        *data;
+    uint8_t        *last = 0;
+    uint8_t         length;
+    uint8_t         seed;
+    uint16_t        cursor;
+    uint16_t        count;
+    uint8_t         drained;
+    uint32_t        wraps = 0;
+    uint32_t        records = 0;
+    int             failures = 0;
+
+    nrfcan_ring_init(&ring, &buff[0], size);
+    for (uint32_t t = 0; (t < TEST_STEPS) && (failures < 5); t++) {
+        if (rand() & 1) {
+            /* Producer, some slots are abandoned without commit */
+            length = 1 + (rand() % TEST_RECORD_MAX);
+            seed = rand();
+            data = nrfcan_ring_reserve(&ring, length);
+            if (data == 0) {
+                continue;
+            }
+            if (((uintptr_t) data % NRFCAN_RING_ALIGN) != 0) {
+                printf("size %u: reserved slot misaligned\n", size);
+                failures++;
+            }
+            test_fill(data, length, seed);
+            if ((rand() % 4) == 0) {
+                continue;
+            }
+            nrfcan_ring_commit(&ring, length);
+            if ((last != 0) && (data < last)) {
+                wraps++;
+            }
+            last = data;
+            model.length[model.head % TEST_MODEL_SIZE] = length;
+            model.seed[model.head % TEST_MODEL_SIZE] = seed;
+            model.head++;
+        } else {
+            /* Consumer peeks a few records and releases them at once */
+            cursor = nrfcan_ring_cursor(&ring);
+            count = 0;
+            drained = 0;
+            while ((rand() % 3) != 0) {
+                data = nrfcan_ring_peek(&ring, &cursor, &length);
+                if (data == 0) {
+                    drained = 1;
+                    break;
+                }
+                if (model.tail + count == model.head) {
+                    printf("size %u: record beyond committed ones\n", size);
+                    failures++;
+                    break;
+                }
+                if ((((uintptr_t) data % NRFCAN_RING_ALIGN) != 0)
+                        || (length != model.length[(model.tail + count) % TEST_MODEL_SIZE])
+                        || test_check(data, length, model.seed[(model.tail + count) % TEST_MODEL_SIZE])) {
+                    printf("size %u: record %u damaged\n", size, (unsigned) records);
+                    failures++;
+                }
+                count++;
+            }
+            if (drained && (model.tail + count != model.head)) {
+                printf("size %u: committed record missing\n", size);
+                failures++;
+            }
+            nrfcan_ring_release(&ring, cursor, count);
+            model.tail += count;
+            records += count;
+        }
+        if ((nrfcan_ring_frames(&ring) != (uint16_t) (model.head - model.tail))
+                || (nrfcan_ring_bytes(&ring) >= size)) {
+            printf("size %u: ring accounting off\n", size);
+            failures++;
+        }
+    }
+    printf("size %u: %u records, %u wraps, %d failures\n", size, (unsigned) records, (unsigned) wraps, failures);
+    if (wraps == 0) {
+        printf("size %u: wrap marker never exercised\n", size);
+        failures++;
+    }
+    return failures;
+}
+
+static int test_uncommitted(void) {
+    static uint16_t buff[32 / sizeof(uint16_t)];
+    nrfcan_ring_t   ring;
+    uint8_t        *first;
+    uint8_t        *data;
+    uint8_t         length;
+    uint16_t        cursor;
+    int             failures = 0;
+
+    nrfcan_ring_init(&ring, &buff[0], sizeof(buff));
+
+    /* Reserved slot stays invisible and is handed out again */
+    first = nrfcan_ring_reserve(&ring, 10);
+    test_fill(first, 10, 0x40);
+    cursor = nrfcan_ring_cursor(&ring);
+    if (nrfcan_ring_peek(&ring, &cursor, &length) != 0) {
+        printf("uncommitted: reserved slot visible\n");
+        failures++;
+    }
+    data = nrfcan_ring_reserve(&ring, 12);
+    if (data != first) {
+        printf("uncommitted: slot not reused\n");
+        failures++;
+    }
+
+    /* Move head close to the end, record there must wrap to the beginning */
+    test_fill(data, 12, 0x10);
+    nrfcan_ring_commit(&ring, 12);
+    cursor = nrfcan_ring_cursor(&ring);
+    nrfcan_ring_peek(&ring, &cursor, &length);
+    nrfcan_ring_release(&ring, cursor, 1);
+    data = nrfcan_ring_reserve(&ring, 8);
+    test_fill(data, 8, 0x20);
+    nrfcan_ring_commit(&ring, 8);
+
+    /* Abandoned slot behind the wrap must not leave a marker behind */
+    first = nrfcan_ring_reserve(&ring, 7);
+    if ((first == 0) || (first > data)) {
+        printf("uncommitted: record did not wrap\n");
+        failures++;
+    }
+    cursor = nrfcan_ring_cursor(&ring);
+    data = nrfcan_ring_peek(&ring, &cursor, &length);
+    if ((data == 0) || (length != 8) || test_check(data, 8, 0x20)) {
+        printf("uncommitted: record before abandoned slot damaged\n");
+        failures++;
+    }
+    if (nrfcan_ring_peek(&ring, &cursor, &length) != 0) {
+        printf("uncommitted: abandoned slot visible\n");
+        failures++;
+    }
+
+    /* Committing the wrapped slot leaves marker, consumer follows it */
+    test_fill(first, 7, 0x30);
+    nrfcan_ring_commit(&ring, 7);
+    data = nrfcan_ring_peek(&ring, &cursor, &length);
+    if ((data != first) || (length != 7) || test_check(data, 7, 0x30)) {
+        printf("uncommitted: wrapped record damaged\n");
+        failures++;
+    }
+    nrfcan_ring_release(&ring, cursor, 2);
+    if ((nrfcan_ring_frames(&ring) != 0) || (nrfcan_ring_bytes(&ring) != 0)) {
+        printf("uncommitted: ring not empty\n");
+        failures++;
+    }
+    printf("uncommitted: %d failures\n", failures);
+    return failures;
+}